@@ -0,0 +1,101 @@
+#include "LogDecoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "../include/LogMessages.h"
+
+typedef bool (*LogArgumentsDecoder)(const unsigned char *next, const unsigned char *end, std::vector<long long> &values);
+
+struct LogMessage {
+    const char *name;
+    const char *format;
+    LogArgumentsDecoder decode;
+};
+
+// The firmware and the host are both little-endian, so arguments are copied
+// as they are
+template <typename T>
+static bool readArgument(const unsigned char *&next, const unsigned char *end, std::vector<long long> &values) {
+    if (end - next < (long)sizeof(T)) {
+        return false;
+    }
+    T value;
+    memcpy(&value, next, sizeof(T));
+    next += sizeof(T);
+    values.push_back(value);
+    return true;
+}
+
+template <typename Signature>
+struct LogArguments;
+
+template <typename... Args>
+struct LogArguments<void(Args...)> {
+    static bool decode(const unsigned char *next, const unsigned char *end, std::vector<long long> &values) {
+        bool isOk = true;
+        int expand[] = {0, (isOk = isOk && readArgument<Args>(next, end, values), 0)...};
+        (void)expand;
+        return isOk && next == end;
+    }
+};
+
+#define LOG_MESSAGE(name, format, ...) {#name, format, &LogArguments<void(__VA_ARGS__)>::decode},
+static const LogMessage MESSAGES[] = {
+    LOG_MESSAGES(LOG_MESSAGE)
+};
+#undef LOG_MESSAGE
+
+static const size_t MESSAGE_COUNT = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+
+static bool parseHex(const std::string &hex, std::vector<unsigned char> &bytes) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        unsigned int value;
+        if (sscanf(hex.c_str() + i, "%2x", &value) != 1) {
+            return false;
+        }
+        bytes.push_back((unsigned char)value);
+    }
+    return true;
+}
+
+static std::string format(const char *format, const std::vector<long long> &values) {
+    std::string text;
+    size_t next = 0;
+    for (const char *c = format; *c != '\0'; ++c) {
+        bool isDecimal = strncmp(c, "{}", 2) == 0;
+        bool isHex = strncmp(c, "{x}", 3) == 0;
+        if ((isDecimal || isHex) && next < values.size()) {
+            char number[24];
+            snprintf(number, sizeof(number), isHex ? "%llX" : "%lld", values[next++]);
+            text += number;
+            c += isHex ? 2 : 1;
+        } else {
+            text += *c;
+        }
+    }
+    return text;
+}
+
+bool decodeLogLine(const std::string &line, std::string &text) {
+    std::vector<unsigned char> bytes;
+    if (line.empty() || line[0] != '$' || !parseHex(line.substr(1), bytes) || bytes.empty()) {
+        return false;
+    }
+    if (bytes[0] >= MESSAGE_COUNT) {
+        return false;
+    }
+
+    const LogMessage &message = MESSAGES[bytes[0]];
+    std::vector<long long> values;
+    if (!message.decode(bytes.data() + 1, bytes.data() + bytes.size(), values)) {
+        return false;
+    }
+    text = format(message.format, values);
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef LOG_DECODER_H
+#define LOG_DECODER_H
+
+#include <string>
+
+// Formats records of the firmware's deferred logger (see Log.h).
+//
+// The string table is built at compile time from the same LogMessages.h the
+// firmware uses, so it matches the firmware built from the same tree. A
+// record line looks like "$0100040A": message ID, then the arguments as
+// little-endian bytes, all in hex.
+//
+// Returns false if the line is not a log record, or if its ID or length
+// does not match the table (firmware from a different tree).
+bool decodeLogLine(const std::string &line, std::string &text);
+
+#endif
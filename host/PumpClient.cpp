@@ -0,0 +1,327 @@
+#include "PumpClient.h"
+
+#include "LogDecoder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+const size_t DEFAULT_WINDOW = PumpClient::MAX_WINDOW;
+const int DEFAULT_TIMEOUT_MS = 500;
+const int DEFAULT_RETRIES = 2;
+
+PumpClient::PumpClient()
+    : fd(-1), window(DEFAULT_WINDOW), timeoutMs(DEFAULT_TIMEOUT_MS), maxRetries(DEFAULT_RETRIES),
+      nextSequence(0), retryCount(0), isSynced(false) {
+}
+
+PumpClient::~PumpClient() {
+    close();
+}
+
+bool PumpClient::open(const std::string &path) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return false;
+    }
+
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return sync();
+}
+
+bool PumpClient::open(int descriptor) {
+    close();
+    fd = descriptor;
+    return fd >= 0 && sync();
+}
+
+void PumpClient::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool PumpClient::isOpen() const {
+    return fd >= 0;
+}
+
+void PumpClient::setWindow(size_t maxInFlight) {
+    window = maxInFlight < 1 ? 1 : (maxInFlight > MAX_WINDOW ? MAX_WINDOW : maxInFlight);
+}
+
+void PumpClient::setTimeout(int timeout) {
+    timeoutMs = timeout;
+}
+
+void PumpClient::setRetries(int retries) {
+    maxRetries = retries;
+}
+
+void PumpClient::setLogHandler(PumpLogHandler handler) {
+    logHandler = handler;
+}
+
+uint8_t PumpClient::submit(const std::string &command, PumpReplyHandler handler) {
+    Request request;
+    request.sequence = nextSequence++;
+    request.command = command;
+    request.handler = handler;
+    request.attempts = 0;
+    request.sentAtMs = 0;
+    queued.push_back(request);
+    return request.sequence;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+static std::string frame(uint8_t sequence, const std::string &command) {
+    return "#" + std::to_string(sequence) + " " + command + "\n";
+}
+
+bool PumpClient::flush() {
+    // One write for everything the window admits
+    std::string batch;
+    double now = nowMs();
+    while (!queued.empty() && sent.size() < window) {
+        Request request = queued.front();
+        queued.pop_front();
+        request.attempts = 1;
+        request.sentAtMs = now;
+        batch += frame(request.sequence, request.command);
+        sent[request.sequence] = request;
+    }
+    return batch.empty() || writeAll(fd, batch);
+}
+
+bool PumpClient::poll(int waitMs) {
+    if (!flush()) {
+        return false;
+    }
+
+    pollfd pfd = {fd, POLLIN, 0};
+    int ready = ::poll(&pfd, 1, waitMs);
+    if (ready < 0 && errno != EINTR) {
+        return false;
+    }
+    if (ready > 0) {
+        char buffer[4096];
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        received.append(buffer, n);
+
+        size_t start = 0;
+        for (size_t i = 0; i < received.size(); ++i) {
+            if (received[i] == '\n' || received[i] == '\r') {
+                if (i > start) {
+                    handleLine(received.substr(start, i - start));
+                }
+                start = i + 1;
+            }
+        }
+        received.erase(0, start);
+    }
+
+    checkTimeouts();
+    return flush();
+}
+
+bool PumpClient::drain() {
+    while (!queued.empty() || !sent.empty()) {
+        if (!poll(timeoutMs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PumpClient::sync() {
+    // Start a session: the device expects our next tag from now on
+    isSynced = false;
+    double deadline = nowMs() + timeoutMs * (maxRetries + 1);
+    double lastSent = 0;
+    while (!isSynced && nowMs() < deadline) {
+        if (nowMs() - lastSent >= timeoutMs) {
+            if (!writeAll(fd, "SYNC " + std::to_string(nextSequence) + "\n")) {
+                return false;
+            }
+            lastSent = nowMs();
+        }
+        if (!poll(timeoutMs / 4 + 1)) {
+            return false;
+        }
+    }
+    return isSynced;
+}
+
+PumpReply PumpClient::call(const std::string &command) {
+    PumpReply result = PumpReply();
+    bool isDone = false;
+    submit(command, [&](const PumpReply &reply) {
+        result = reply;
+        isDone = true;
+    });
+    while (!isDone) {
+        if (!poll(timeoutMs)) {
+            result.isOk = false;
+            break;
+        }
+    }
+    return result;
+}
+
+size_t PumpClient::pending() const {
+    return queued.size();
+}
+
+size_t PumpClient::inFlight() const {
+    return sent.size();
+}
+
+unsigned long PumpClient::retries() const {
+    return retryCount;
+}
+
+void PumpClient::handleLine(const std::string &line) {
+    if (line[0] == '@') {
+        handleAck((uint8_t)atoi(line.c_str() + 1));
+        return;
+    }
+    if (line[0] == '$') {
+        std::string text;
+        if (logHandler) {
+            logHandler(decodeLogLine(line, text) ? text : line);
+        }
+        return;
+    }
+    // Other untagged output (boot report, display mirror) is not for us
+    if (line[0] != '#') {
+        return;
+    }
+    char *rest;
+    long sequence = strtol(line.c_str() + 1, &rest, 10);
+    if (*rest == ' ') {
+        rest++;
+    }
+
+    std::map<uint8_t, Request>::iterator it = sent.find((uint8_t)sequence);
+    if (it == sent.end()) {
+        return; // Late reply to an attempt we already gave up on
+    }
+
+    std::string text(rest);
+    if (text == "OK" || text == "ERR") {
+        complete(it->second, text == "OK", false);
+    } else {
+        it->second.lines.push_back(text);
+    }
+}
+
+void PumpClient::handleAck(uint8_t next) {
+    if (!isSynced) {
+        isSynced = next == nextSequence;
+        return;
+    }
+
+    // Everything before next has been executed: whatever is still waiting
+    // for a reply lost it
+    std::vector<uint8_t> executed;
+    for (std::map<uint8_t, Request>::iterator it = sent.begin(); it != sent.end(); ++it) {
+        uint8_t behind = next - it->first;
+        if (behind >= 1 && behind <= MAX_WINDOW) {
+            executed.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < executed.size(); ++i) {
+        complete(sent[executed[i]], false, false, true);
+    }
+
+    // The device is holding later frames and waits for this one
+    std::map<uint8_t, Request>::iterator missing = sent.find(next);
+    if (missing != sent.end() && missing->second.attempts == 1) {
+        resend(missing->second);
+        writeAll(fd, frame(next, missing->second.command));
+    }
+}
+
+void PumpClient::resend(Request &request) {
+    request.attempts++;
+    request.sentAtMs = nowMs();
+    request.lines.clear();
+    retryCount++;
+}
+
+void PumpClient::complete(Request &request, bool isOk, bool isTimedOut, bool isReplyLost) {
+    PumpReply reply;
+    reply.sequence = request.sequence;
+    reply.isOk = isOk;
+    reply.isTimedOut = isTimedOut;
+    reply.isReplyLost = isReplyLost;
+    reply.lines.swap(request.lines);
+    reply.roundTripMs = nowMs() - request.sentAtMs;
+
+    PumpReplyHandler handler = request.handler;
+    sent.erase(request.sequence);
+    if (handler) {
+        handler(reply);
+    }
+}
+
+void PumpClient::checkTimeouts() {
+    double now = nowMs();
+    std::string resends;
+    std::vector<uint8_t> failed;
+
+    for (std::map<uint8_t, Request>::iterator it = sent.begin(); it != sent.end(); ++it) {
+        Request &request = it->second;
+        if (now - request.sentAtMs < timeoutMs) {
+            continue;
+        }
+        if (request.attempts > maxRetries) {
+            failed.push_back(request.sequence);
+            continue;
+        }
+        // Same tag, so the device can tell a resend from a new command
+        resend(request);
+        resends += frame(request.sequence, request.command);
+    }
+
+    for (size_t i = 0; i < failed.size(); ++i) {
+        complete(sent[failed[i]], false, true);
+    }
+    if (!resends.empty()) {
+        writeAll(fd, resends);
+    }
+}
+
+double PumpClient::nowMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
@@ -0,0 +1,113 @@
+#ifndef PUMP_CLIENT_H
+#define PUMP_CLIENT_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Host side of the pump's windowed command protocol (see HostLink.h in the
+// firmware).
+//
+// Commands are tagged with a sequence number and pipelined: up to
+// setWindow() commands are in flight at once and replies are matched back by
+// tag, so a link with a long round trip still carries one command per line
+// time instead of one per round trip. Commands submitted together are
+// written with a single write() call.
+//
+// A command whose reply does not arrive within the timeout is resent under
+// the same tag, and one the device reports missing in an ack is resent at
+// once. The device never executes a tag twice. If it already ran the command
+// and only the reply was lost, the command completes with isReplyLost set.
+struct PumpReply {
+    uint8_t sequence;
+    bool isOk;
+    bool isTimedOut;
+    bool isReplyLost;               // Executed, but the reply never arrived
+    std::vector<std::string> lines; // Reply lines before OK/ERR, tag stripped
+    double roundTripMs;             // Of the attempt that was answered
+};
+
+typedef std::function<void(const PumpReply &)> PumpReplyHandler;
+
+// Receives each log record of the firmware, formatted (see LogDecoder.h).
+// Records that do not decode are passed through as received.
+typedef std::function<void(const std::string &)> PumpLogHandler;
+
+class PumpClient {
+public:
+    PumpClient();
+    ~PumpClient();
+
+    // Opens the port and synchronizes sequence numbers with the device
+    bool open(const std::string &path);
+    bool open(int descriptor); // Already open, e.g. one end of a socketpair
+    void close();
+    bool isOpen() const;
+
+    void setWindow(size_t maxInFlight);
+    void setTimeout(int timeoutMs);
+    void setRetries(int retries);
+    void setLogHandler(PumpLogHandler handler);
+
+    // Queues a command. It is written by the next flush() or poll(), and
+    // handler runs from poll() once the reply is complete or retries are
+    // exhausted.
+    uint8_t submit(const std::string &command, PumpReplyHandler handler = PumpReplyHandler());
+
+    // Writes as many queued commands as the window allows
+    bool flush();
+
+    // Waits up to timeoutMs for replies, dispatches them and resends timed
+    // out commands. Returns false if the port failed.
+    bool poll(int timeoutMs);
+
+    // Polls until every submitted command is answered or has failed
+    bool drain();
+
+    // Blocking convenience wrapper around submit() and poll()
+    PumpReply call(const std::string &command);
+
+    size_t pending() const;
+    size_t inFlight() const;
+    unsigned long retries() const;
+
+    // Must not exceed the device's receive window (HostLink::WINDOW)
+    static const size_t MAX_WINDOW = 4;
+
+private:
+    struct Request {
+        uint8_t sequence;
+        std::string command;
+        PumpReplyHandler handler;
+        int attempts;
+        double sentAtMs;
+        std::vector<std::string> lines;
+    };
+
+    bool sync();
+    void handleLine(const std::string &line);
+    void handleAck(uint8_t next);
+    void resend(Request &request);
+    void complete(Request &request, bool isOk, bool isTimedOut, bool isReplyLost = false);
+    void checkTimeouts();
+    static double nowMs();
+
+    int fd;
+    size_t window;
+    int timeoutMs;
+    int maxRetries;
+    uint8_t nextSequence;
+    unsigned long retryCount;
+    bool isSynced;
+    PumpLogHandler logHandler;
+
+    std::deque<Request> queued;
+    std::map<uint8_t, Request> sent;
+    std::string received;
+};
+
+#endif
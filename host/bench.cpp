@@ -0,0 +1,76 @@
+// Throughput and latency of the command protocol against a pump or the
+// native virtual device:
+//
+//   pump-bench <port> [count] [window]
+//
+// Runs count PINGs stop-and-wait, then pipelined with the given window, and
+// exits non-zero if any command was not answered with OK.
+
+#include "PumpClient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+static double nowMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static bool runBenchmark(PumpClient &client, const char *label, int count, size_t window) {
+    std::vector<double> roundTrips;
+    int failures = 0;
+    unsigned long retriesBefore = client.retries();
+
+    client.setWindow(window);
+    double start = nowMs();
+    for (int i = 0; i < count; ++i) {
+        client.submit("PING", [&](const PumpReply &reply) {
+            if (reply.isOk) {
+                roundTrips.push_back(reply.roundTripMs);
+            } else {
+                failures++;
+            }
+        });
+    }
+    if (!client.drain()) {
+        fprintf(stderr, "%s: port failed\n", label);
+        return false;
+    }
+    double elapsed = nowMs() - start;
+
+    std::sort(roundTrips.begin(), roundTrips.end());
+    double sum = 0;
+    for (size_t i = 0; i < roundTrips.size(); ++i) {
+        sum += roundTrips[i];
+    }
+    size_t n = roundTrips.size();
+    printf("%-14s window %-3zu %8.0f cmd/s  rtt avg %.3f p50 %.3f p99 %.3f ms  failed %d  retries %lu\n", label, window,
+           count * 1e3 / elapsed, n > 0 ? sum / n : 0.0, n > 0 ? roundTrips[n / 2] : 0.0,
+           n > 0 ? roundTrips[n * 99 / 100] : 0.0, failures, client.retries() - retriesBefore);
+    return failures == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <port> [count] [window]\n", argv[0]);
+        return 2;
+    }
+    int count = argc > 2 ? atoi(argv[2]) : 1000;
+    size_t window = argc > 3 ? atoi(argv[3]) : PumpClient::MAX_WINDOW;
+
+    PumpClient client;
+    if (!client.open(argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+    client.setLogHandler([](const std::string &text) { fprintf(stderr, "log: %s\n", text.c_str()); });
+
+    bool isOk = runBenchmark(client, "stop-and-wait", count, 1);
+    isOk = runBenchmark(client, "pipelined", count, window) && isOk;
+    return isOk ? 0 : 1;
+}
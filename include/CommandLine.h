@@ -0,0 +1,31 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include <Arduino.h>
+
+// Collects newline-terminated commands from a stream without blocking.
+class CommandLine {
+public:
+    // Fits a tagged RECIPE of RECIPE_MAX_DOSES doses like A125.25:
+    // "#255 RECIPE " + 8 doses of 7 + 7 " > " = 89
+    static const uint8_t MAX_LENGTH = 96;
+
+    explicit CommandLine(Stream &stream);
+
+    // Returns the next complete line with the terminator stripped, or NULL.
+    // Overlong lines are cut to MAX_LENGTH, see isTruncated(). The buffer
+    // is reused by the next call.
+    char *poll();
+
+    // True if the line poll() last returned was cut short.
+    bool isTruncated() const { return wasOverflowed; }
+
+private:
+    Stream &stream;
+    char buffer[MAX_LENGTH + 1];
+    uint8_t length;
+    bool isOverflowed;
+    bool wasOverflowed;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef DRY_RUN_SENSOR_H
+#define DRY_RUN_SENSOR_H
+
+#include <Arduino.h>
+
+const uint8_t DRY_RUN_SENSOR_PIN = 7; // AIN1
+
+// Liquid presence sensor at the reservoir outlet, on the analog comparator.
+//
+// The comparator weighs the sensor output on AIN1 against the internal
+// 1.1 V bandgap reference, continuously and in hardware. The sensor reads
+// above 1.1 V with liquid present. When it drops below, the comparator
+// interrupt calls the handler within a few microseconds, with no ADC
+// conversion and nothing polled in loop(). The ADC stays free for the
+// occlusion monitor.
+//
+// The comparator has no hysteresis, so a sensor that chatters at the
+// threshold needs an RC filter in front of the pin.
+void beginDryRunSensor(void (*handler)()); // Handler runs in the interrupt
+bool isReservoirEmpty();
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef EEPROM_LAYOUT_H
+#define EEPROM_LAYOUT_H
+
+// EEPROM address map (ATmega328P: 1024 bytes)
+const int CALIBRATION_ADDR = 0;     // float, revolutions per ml, from before fluid profiles
+const int ACTIVE_PROFILE_ADDR = 4;  // uint8_t, selected fluid profile slot
+const int PROFILES_ADDR = 16;       // PROFILE_COUNT * sizeof(FluidProfile)
+const int PARAMS_ADDR = 160;        // PARAM_RECORD_COUNT * 6, see Parameters.cpp
+const int TRACE_ADDR = 352;         // uint8_t count, then TRACE_SAVED_SIZE * sizeof(TraceEntry)
+const int BANDS_ADDR = 416;         // PROFILE_COUNT * PROFILE_BANDS * sizeof(ResonanceBand)
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <Arduino.h>
+
+// Background EEPROM writer.
+//
+// A byte takes ~3.3 ms to program, so writing a float synchronously stalls
+// the loop for over 13 ms. write()/put() only queue the bytes; the EE_READY
+// interrupt programs them one after another. Bytes that already hold the
+// value are skipped to save wear.
+//
+// read()/get() see queued bytes before they reach the EEPROM, so callers can
+// read back what they just wrote without waiting for isIdle(). Other bytes
+// are read once the byte being programmed is done, with the queue held so
+// the interrupt cannot start the next one in between.
+//
+// The queue holds the largest record, a FluidProfile, so saving one only
+// waits when earlier writes are still draining.
+class EepromQueue {
+public:
+    static const uint8_t QUEUE_SIZE = 32;
+
+    EepromQueue();
+
+    void write(uint16_t address, uint8_t value);
+    uint8_t read(uint16_t address) const;
+    bool isIdle() const;
+
+    template <typename T>
+    void put(uint16_t address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (uint16_t i = 0; i < sizeof(T); ++i) {
+            write(address + i, bytes[i]);
+        }
+    }
+
+    template <typename T>
+    T &get(uint16_t address, T &value) const {
+        uint8_t *bytes = (uint8_t *)&value;
+        holdWrites();
+        for (uint16_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = readHeld(address + i);
+        }
+        releaseWrites();
+        return value;
+    }
+
+    void onReady(); // Called from the EE_READY interrupt
+
+private:
+    void holdWrites() const; // Returns once no byte is being programmed
+    uint8_t readHeld(uint16_t address) const;
+    void releaseWrites() const;
+
+    uint16_t addresses[QUEUE_SIZE];
+    uint8_t values[QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t count;
+    volatile bool writing; // The head entry is being programmed
+};
+
+extern EepromQueue eepromQueue;
+
+#endif
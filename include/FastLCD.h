@@ -0,0 +1,91 @@
+#ifndef FAST_LCD_H
+#define FAST_LCD_H
+
+#include <Arduino.h>
+
+// HD44780 driver for PCF8574 I2C backpacks.
+//
+// Every character costs four expander bytes (two per nibble: EN high, EN low)
+// and a whole string is packed into as few Wire transactions as the Wire
+// buffer allows, with the bus running at 400 kHz. LiquidCrystal_I2C instead
+// opens a separate transaction for each expander write.
+//
+// Writes never wait on the controller. They are queued, and update() sends
+// them once the controller is ready again. The driver tracks when that will
+// be (37 us per write, 1.52 ms after clear/home) instead of polling the busy
+// flag or sleeping. Call update() from loop(). The power-up reset sequence
+// is scheduled the same way, so init() does not block.
+//
+// print(), setCursor() and clear() draw into a framebuffer. update() diffs it
+// against what is on the display and sends only the changed runs. clear()
+// therefore just blanks the framebuffer. Redrawing a whole screen after
+// clear() costs nothing on the bus except the characters that differ.
+//
+// setMirror() copies each changed run to a serial port as an ANSI cursor
+// positioning sequence, so a host terminal shows the same screen in its top
+// two rows. Each run is a line of its own, starting with ESC and ending in CR.
+class FastLCD : public Print {
+public:
+    FastLCD(uint8_t address, uint8_t cols, uint8_t rows);
+
+    void init();
+    void backlight();
+    void noBacklight();
+    void clear();
+    void home();
+    void setCursor(uint8_t col, uint8_t row);
+
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    void update();
+    void flush() override;
+    bool isIdle() const;
+
+    void setMirror(Print *out);
+
+private:
+    static const uint8_t QUEUE_SIZE = 40;
+
+    // Framebuffer dimensions, sized for the 16x2 module
+    static const uint8_t MAX_COLS = 16;
+    static const uint8_t MAX_ROWS = 2;
+
+    void enqueue(uint8_t value, uint8_t op);
+    void diffFrame();
+    void mirrorRun(uint8_t row, uint8_t col, uint8_t length);
+    bool isReady() const;
+    void beginBurst();
+    void pushByte(uint8_t value, uint8_t mode);
+    void pushNibble(uint8_t bits);
+    void endBurst();
+    void expanderWrite(uint8_t bits);
+
+    uint8_t address;
+    uint8_t cols;
+    uint8_t rows;
+    uint8_t backlightBits;
+    uint8_t lastMode;
+    uint8_t burstBytes;
+
+    // Pending writes, sent by update()
+    uint8_t queueValues[QUEUE_SIZE];
+    uint8_t queueOps[QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueCount;
+
+    // What the application drew, and what the controller currently shows
+    uint8_t frame[MAX_ROWS][MAX_COLS];
+    uint8_t shown[MAX_ROWS][MAX_COLS];
+    uint8_t cursorCol;
+    uint8_t cursorRow;
+    bool dirty;
+
+    Print *mirror;
+
+    // micros() timestamp at which the controller accepts the next write
+    unsigned long readyAt;
+};
+
+#endif
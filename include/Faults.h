@@ -0,0 +1,41 @@
+#ifndef FAULTS_H
+#define FAULTS_H
+
+#include <Arduino.h>
+
+// Faults stop the pump until they are cleared.
+//
+// Anything may latch a fault with latchFault(), ISRs included. loop() then
+// stops the motor at once and enters the Fault state. Only the first fault
+// is kept, so the display and STATUS show what went wrong originally rather
+// than its consequences. clearFault() (fast press or CLEAR) resets it.
+//
+// setFaultHook() runs a function when a fault is latched, for what has to
+// stop before loop() gets there. It runs wherever latchFault() was called,
+// so it must be safe from ISRs.
+
+//  X(fault)
+#define FAULTS(X)          \
+    X(NONE)                \
+    X(MOTION_TIMEOUT)      \
+    X(STALL)               \
+    X(OCCLUSION)           \
+    X(SCALE)               \
+    X(DRY_RUN)             \
+    X(ESTOP)
+
+#define FAULT_ENUM(name) FAULT_##name,
+enum FaultCode : uint8_t {
+    FAULTS(FAULT_ENUM)
+    FAULT_COUNT
+};
+#undef FAULT_ENUM
+
+extern volatile uint8_t activeFault;
+
+void setFaultHook(void (*hook)());
+void latchFault(uint8_t fault);
+void clearFault();
+size_t printFault(Print &out, uint8_t fault);
+
+#endif
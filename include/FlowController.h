@@ -0,0 +1,30 @@
+#ifndef FLOW_CONTROLLER_H
+#define FLOW_CONTROLLER_H
+
+#include <Arduino.h>
+
+// Closed-loop flow rate from the flow meter.
+//
+// Open loop, the step rate follows from the calibration, which drifts with
+// tube wear, temperature and back pressure. A PID on the metered rate trims
+// the commanded rate instead, within half the target either way.
+//
+// loop() calls updateFlowControl() every pid_update_ms with the metered
+// rate and passes the returned step interval to the step engine. The
+// controller works in ul/min with integer arithmetic only. The gains pid_p,
+// pid_i and pid_d are in 1/256: pid_p 256 adds 1 ul/min per ul/min of
+// error. pid_i and pid_d act per update, so they depend on pid_update_ms.
+//
+// Anti-windup: the integral only grows while the meter sees flow and the
+// output is not already at its limit in the direction of the error, and its
+// term is clamped to the trim range.
+bool beginFlowControl(uint32_t targetUlPerMin, float stepsPerMl); // false if out of range
+void endFlowControl();
+bool isFlowControlled();
+
+uint32_t updateFlowControl(uint32_t measuredUlPerMin); // New step interval, timer ticks
+uint32_t flowControlInterval();                         // Current step interval, timer ticks
+uint32_t flowControlTarget();                           // ul/min
+uint32_t flowControlOutput();                           // Commanded rate, ul/min
+
+#endif
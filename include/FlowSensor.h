@@ -0,0 +1,26 @@
+#ifndef FLOW_SENSOR_H
+#define FLOW_SENSOR_H
+
+#include <Arduino.h>
+
+const uint8_t FLOW_SENSOR_PIN = 8; // ICP1
+
+// Hall-effect flow meter on the Timer1 input capture pin.
+//
+// Timer1 runs free at 0.5 us per tick and the capture unit latches its
+// count on each rising edge in hardware. The capture interrupt only
+// extends the timestamp to 32 bits, counts the pulse and keeps the period,
+// so the timing is exact to the tick whatever else is running, and nothing
+// polls the pin.
+//
+// The meter's K factor (pulses per litre, from its datasheet) is the
+// flow_k parameter. The rate reads 0 once no pulse has arrived for
+// FLOW_TIMEOUT_US.
+void beginFlowSensor();
+
+uint32_t flowPulseCount();          // Since boot, wraps
+uint32_t flowPeriodUs();            // Smoothed, 0 when not flowing
+uint32_t flowRateUlPerMin();        // 0 when not flowing
+float flowVolumeMl(uint32_t pulses);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef FLUID_PROFILES_H
+#define FLUID_PROFILES_H
+
+#include <Arduino.h>
+
+const uint8_t PROFILE_COUNT = 4;
+const uint8_t PROFILE_NAME_LENGTH = 8; // Including the terminator
+const uint8_t PROFILE_CURVE_POINTS = 3;
+const uint8_t PROFILE_BANDS = 2;
+
+// Limits the PROFILE command accepts
+const uint16_t PROFILE_MIN_SPEED = 50; // steps/s
+const uint16_t PROFILE_MAX_SPEED = 8000;
+const uint16_t PROFILE_MIN_ACCELERATION = 100; // steps/s^2
+const uint16_t PROFILE_MAX_ACCELERATION = 60000;
+const uint16_t PROFILE_MAX_SUCK_BACK = 10000; // steps, 0 turns it off
+
+// Per-fluid calibration and motion limits, one slot each in EEPROM.
+//
+// Viscous fluids deliver less per step at higher speeds, so the calibration
+// is a curve of steps/ml over step rate, interpolated linearly between
+// points and held flat outside them.
+struct FluidProfile {
+    char name[PROFILE_NAME_LENGTH];
+    uint16_t curveSpeed[PROFILE_CURVE_POINTS];   // steps/s, ascending
+    float curveStepsPerMl[PROFILE_CURVE_POINTS];
+    uint16_t maxSpeed;      // steps/s
+    uint16_t acceleration;  // steps/s^2
+    uint16_t suckBackSteps; // Reverse after a dispense to stop drips
+};
+
+// Speeds where the pump resonates and loses steps, steps/s. The motor
+// passes through a band but never runs inside it. Stored apart from the
+// profiles so the slots written before bands existed keep their addresses.
+struct ResonanceBand {
+    uint16_t low;
+    uint16_t high; // Not above low: no band
+};
+
+// The selected profile, cached in RAM
+extern FluidProfile activeProfile;
+extern ResonanceBand activeBands[PROFILE_BANDS];
+extern uint8_t activeProfileSlot;
+
+void loadProfiles(float legacyStepsPerMl);
+bool selectProfile(uint8_t slot);
+void readProfile(uint8_t slot, FluidProfile &profile);
+void writeProfile(uint8_t slot, const FluidProfile &profile);
+void saveActiveProfile();
+void readBands(uint8_t slot, ResonanceBand *bands);
+void writeBands(uint8_t slot, const ResonanceBand *bands);
+
+float stepsPerMl(const FluidProfile &profile, uint16_t speed);
+void setCalibrationPoint(FluidProfile &profile, uint16_t speed, float stepsPerMl);
+
+#endif
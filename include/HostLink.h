@@ -0,0 +1,59 @@
+#ifndef HOST_LINK_H
+#define HOST_LINK_H
+
+#include <Arduino.h>
+
+#include "CommandLine.h"
+
+// Returns true if the command succeeded. Reply lines are printed by the
+// handler itself, each starting with HostLink::beginReplyLine().
+typedef bool (*CommandHandler)(char *command);
+
+// Windowed command protocol on the serial port.
+//
+//   host -> device   #<seq> <command>     seq counts 0..255 and wraps
+//   device -> host   #<seq> <reply line>  any number, then
+//                    #<seq> OK|ERR        final line of the reply
+//                    @<next>              cumulative ack
+//
+// Frames are executed strictly in sequence order. A frame that arrives up to
+// WINDOW - 1 ahead of the next expected one is held until the gap is filled.
+// Frames from the last WINDOW are duplicates: they are not executed again.
+// An ack then tells the host that every frame before <next> has been
+// executed. The same ack goes out when a frame arrives out of order, so the
+// host can resend the missing one at once. All bookkeeping is indexed by
+// seq % WINDOW, so each frame costs O(1). An empty frame, or one too long
+// for the line buffer, takes its turn like any other but is answered ERR
+// without running.
+//
+// "SYNC <seq>" (untagged) resets the expected sequence number at the start
+// of a host session and is answered with an ack. Untagged commands are
+// executed right away, outside the window, for use from a terminal.
+//
+// Untagged lines starting with $ between replies are log records (Log.h).
+class HostLink {
+public:
+    static const uint8_t WINDOW = 4;
+
+    HostLink(Stream &stream, CommandHandler handler);
+
+    void poll();
+    void beginReplyLine();
+
+private:
+    void receiveFrame(uint8_t sequence, char *command);
+    void execute(int sequence, char *command);
+    void sendAck();
+
+    Stream &stream;
+    CommandLine commandLine;
+    CommandHandler handler;
+
+    uint8_t nextExpected;
+    int replySequence; // Tag of the frame being executed, -1 if untagged
+
+    char frames[WINDOW][CommandLine::MAX_LENGTH + 1];
+    bool isBuffered[WINDOW];
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef LOAD_CELL_H
+#define LOAD_CELL_H
+
+#include <Arduino.h>
+
+const uint8_t LOAD_CELL_DOUT_PIN = 12; // HX711 data
+const uint8_t LOAD_CELL_SCK_PIN = 11;  // HX711 clock
+
+// Load cell under the receiving vessel, through an HX711 amplifier.
+//
+// The HX711 converts continuously (10 or 80 samples/s, set by its RATE pin)
+// and pulls DOUT low when a sample is ready. loadCellUpdate() is called
+// from loop() and returns at once unless a sample is waiting, so nothing
+// ever waits for a conversion. Shifting a sample out takes about 100 us.
+//
+// tareLoadCell() averages the next LOAD_CELL_TARE_SAMPLES samples as the
+// zero. The scale_cpg parameter is the counts per gram of the cell.
+// isLoadCellResponding() turns false when no sample has arrived for
+// LOAD_CELL_TIMEOUT_MS, for example with the cable unplugged.
+const uint8_t LOAD_CELL_TARE_SAMPLES = 8;
+const unsigned long LOAD_CELL_TIMEOUT_MS = 500;
+
+void beginLoadCell();
+bool loadCellUpdate(); // true when a new sample was read
+
+void tareLoadCell();
+bool isLoadCellTared();
+bool isLoadCellResponding();
+
+int32_t loadCellRaw(); // Latest sample, counts
+int32_t loadCellMg();  // Latest sample above the tare, mg
+
+#endif
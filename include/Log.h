@@ -0,0 +1,77 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+#include "LogMessages.h"
+
+// Deferred binary logger.
+//
+//   LOG(STATE, previousState, currentState);
+//
+// A log site stores the message ID and the raw bytes of its arguments in a
+// RAM ring buffer: a few register moves and a short copy with interrupts
+// off, no formatting and no strings in flash. It is safe to call from ISRs.
+// logFlush() in loop() sends each record as a line
+//
+//   $<id><argument bytes>      hex, arguments little-endian
+//
+// and only when the serial transmit buffer has room, so it never blocks.
+// The host client formats the records with the table in LogMessages.h.
+//
+// Arguments are converted to the types declared in LogMessages.h, so the
+// decoder always knows how many bytes each one takes. A record that does
+// not fit is dropped and counted, and the count is logged once there is
+// room again.
+
+#define LOG_ID(name, format, ...) LOG_##name,
+enum LogId : uint8_t {
+    LOG_MESSAGES(LOG_ID)
+    LOG_ID_COUNT
+};
+#undef LOG_ID
+
+#define LOG_SIGNATURE(name, format, ...) typedef void LogSignature_##name(__VA_ARGS__);
+LOG_MESSAGES(LOG_SIGNATURE)
+#undef LOG_SIGNATURE
+
+#define LOG(name, ...) LogRecord<LogSignature_##name>::write(LOG_##name, __VA_ARGS__)
+
+const uint8_t LOG_BUFFER_SIZE = 64; // Power of two
+const uint8_t LOG_MAX_RECORD = 16;  // ID and arguments
+
+bool logWrite(const uint8_t *record, uint8_t size);
+void logFlush(Print &out);
+
+template <typename... Args>
+struct LogArgsSize;
+
+template <>
+struct LogArgsSize<> {
+    static const uint8_t value = 0;
+};
+
+template <typename T, typename... Rest>
+struct LogArgsSize<T, Rest...> {
+    static const uint8_t value = sizeof(T) + LogArgsSize<Rest...>::value;
+};
+
+template <typename Signature>
+struct LogRecord;
+
+template <typename... Args>
+struct LogRecord<void(Args...)> {
+    static const uint8_t SIZE = 1 + LogArgsSize<Args...>::value;
+    static_assert(SIZE <= LOG_MAX_RECORD, "log message has too many argument bytes");
+
+    static bool write(uint8_t id, Args... args) {
+        uint8_t record[SIZE];
+        uint8_t *next = record + 1;
+        record[0] = id;
+        int expand[] = {0, (memcpy(next, &args, sizeof(args)), next += sizeof(args), 0)...};
+        (void)expand;
+        return logWrite(record, SIZE);
+    }
+};
+
+#endif
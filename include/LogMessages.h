@@ -0,0 +1,40 @@
+#ifndef LOG_MESSAGES_H
+#define LOG_MESSAGES_H
+
+#include <stdint.h>
+
+// Messages of the deferred logger (see Log.h).
+//
+// Shared by the firmware and the host decoder. The firmware only expands the
+// names and argument types, so the format strings never reach flash. The
+// host expands all three to build its string table. Each {} in the format
+// takes the next argument in decimal, {x} in hex.
+//
+// Append new messages at the end: the position is the message ID, and
+// reordering makes logs from older firmware decode wrongly.
+//
+//  X(name, format, argument types...)
+#define LOG_MESSAGES(X)                                                      \
+    X(DROPPED, "{} log records dropped", uint16_t)                           \
+    X(STATE, "state {} -> {}", uint8_t, uint8_t)                             \
+    X(BUTTON, "button released after {} ms", uint16_t)                       \
+    X(DISPENSE_START, "dispense {} steps", int32_t)                          \
+    X(DISPENSE_DONE, "dispense done at {}, suck-back {}", int32_t, uint8_t)  \
+    X(DISPENSE_STOP, "dispense stopped, {} steps to go", int32_t)            \
+    X(CALIBRATED, "calibrated {} revolutions to {} ml", uint8_t, uint8_t)    \
+    X(PROFILE_SELECT, "fluid profile {} selected", uint8_t)                  \
+    X(PARAM_SET, "parameter 0x{x} set to {}", uint16_t, int32_t)             \
+    X(FAULT, "fault {}", uint8_t)                                            \
+    X(OCCLUSION, "occlusion, current {} baseline {}", uint16_t, uint16_t)    \
+    X(DISPENSE_METERED, "dispense metered {} ul of {} ul", int32_t, int32_t) \
+    X(FLOW_CONTROL, "flow control to {} ul/min", uint32_t)                   \
+    X(FILL_START, "fill to {} mg", int32_t)                                  \
+    X(FILL_DONE, "fill done at {} mg of {} mg", int32_t, int32_t)            \
+    X(DISPENSE_ABORT, "dispense aborted at {}, fault {}", int32_t, uint8_t)  \
+    X(TRAY_START, "tray of {} containers, {} ul each", uint8_t, int32_t)     \
+    X(TRAY_DONE, "tray done, {} containers filled", uint8_t)                 \
+    X(RECIPE_START, "recipe of {} doses, {} ms planned", uint8_t, uint32_t)  \
+    X(DOSE_START, "dose {} on pump {}, {} steps", uint8_t, uint8_t, int32_t) \
+    X(RECIPE_DONE, "recipe done in {} ms", uint32_t)
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef MOTION_SUPERVISOR_H
+#define MOTION_SUPERVISOR_H
+
+#include <Arduino.h>
+
+// Watches every move for two failures that would otherwise run the pump
+// forever:
+//
+//   MOTION_TIMEOUT  the move takes longer than its trapezoidal profile
+//                   allows, plus move_margin_pct and a fixed slack
+//   STALL           the position has not changed for stall_time_ms
+//                   while steps are still to go
+//
+// Each step engine channel is supervised on its own. superviseMove() is
+// called with each new move, checkMotion() as often as loop() runs. It
+// returns the fault to latch, or FAULT_NONE.
+const uint8_t SUPERVISED_CHANNELS = 2; // One per step engine channel
+
+void superviseMove(uint8_t channel, long steps, float speed, float acceleration);
+void endSupervision(uint8_t channel);
+uint8_t checkMotion(uint8_t channel, long position, long distanceToGo);
+
+// Duration of a move with the trapezoidal profile, in seconds
+float moveSeconds(long steps, float speed, float acceleration);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef OCCLUSION_MONITOR_H
+#define OCCLUSION_MONITOR_H
+
+#include <Arduino.h>
+
+const uint8_t CURRENT_SENSE_PIN = A2; // Stepper driver current-sense output
+
+// Detects a blocked tube from the motor current while dispensing.
+//
+// occlusionStep() is called right after each step pulse. Every
+// OCCLUSION_STEP_INTERVAL-th call sets Timer0 compare A to occl_phase_us
+// ahead, and the ADC, auto-triggered by that compare match, samples the
+// current-sense input without any code running at that moment. Samples are
+// therefore taken at the same point of the current waveform, whatever the
+// loop() latency. The ADC interrupt evaluates them. Timer0 is in normal
+// mode while monitoring so the new compare value applies at once.
+//
+// The first OCCLUSION_WARMUP samples only seed the baseline. After that,
+// a sample more than occl_rise_pct above the baseline counts as high, and
+// occl_samples high samples in a row latch FAULT_OCCLUSION. Other samples
+// update the rolling baseline, which follows slow changes such as tube
+// wear.
+//
+// analogRead() shares the ADC, so it must not be used while monitoring.
+void beginOcclusionMonitor();
+void endOcclusionMonitor();
+void occlusionStep();
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef PARAMETERS_H
+#define PARAMETERS_H
+
+#include <Arduino.h>
+
+// Tunable parameters, persisted in EEPROM and settable over serial.
+//
+// Each parameter is identified by a 16-bit hash of its name, computed at
+// compile time. The top bits of a multiplicative hash of that ID are a
+// perfect hash into a PARAM_TABLE_SIZE slot table. The static_assert in
+// Parameters.cpp checks that no two parameters share a slot, so lookup by ID
+// is a multiply, a shift and one PROGMEM read. When a new name collides,
+// change PARAM_HASH_SEED (odd) until the build passes. The table has twice
+// as many slots as there can be parameters, so such a seed is easy to find.
+//
+// Saved values are found by ID, not by slot, so changing the seed keeps
+// them.
+//
+// Descriptors (type, range, default) live in PROGMEM. Values are cached in
+// RAM as int32_t, so paramGet() is a plain array read, safe from ISRs.
+
+enum ParamType {
+    PARAM_BOOL,
+    PARAM_U8,
+    PARAM_U16,
+    PARAM_I32
+};
+
+//  X(index, name, type, minimum, maximum, default)
+#define PARAMETERS(X)                                                      \
+    X(P_DEBOUNCE_MS, "debounce_ms", PARAM_U16, 10, 1000, 50)               \
+    X(P_LONG_PRESS_MS, "long_press_ms", PARAM_U16, 1000, 30000, 5000)      \
+    X(P_FAST_PRESS_MS, "fast_press_ms", PARAM_U16, 100, 5000, 1500)        \
+    X(P_MENU_HOLD_MS, "menu_hold_ms", PARAM_U16, 500, 10000, 2000)         \
+    X(P_PURGE_DELAY_MS, "purge_delay_ms", PARAM_U16, 0, 60000, 2000)       \
+    X(P_CAL_SPEED, "cal_speed", PARAM_U16, 50, 2000, 400)                  \
+    X(P_CAL_REVS, "cal_revs", PARAM_U8, 1, 100, 10)                        \
+    X(P_MAX_DISPENSE_ML, "max_dispense_ml", PARAM_U16, 1, 5000, 250)       \
+    X(P_MOVE_MARGIN_PCT, "move_margin_pct", PARAM_U8, 10, 250, 50)         \
+    X(P_STALL_TIME_MS, "stall_time_ms", PARAM_U16, 100, 10000, 1000)       \
+    X(P_OCCL_RISE_PCT, "occl_rise_pct", PARAM_U8, 5, 200, 30)              \
+    X(P_OCCL_SAMPLES, "occl_samples", PARAM_U8, 1, 250, 20)                \
+    X(P_OCCL_PHASE_US, "occl_phase_us", PARAM_U16, 8, 1000, 100)           \
+    X(P_FLOW_K, "flow_k", PARAM_U16, 100, 60000, 5880)                     \
+    X(P_PID_P, "pid_p", PARAM_U16, 0, 2000, 128)                           \
+    X(P_PID_I, "pid_i", PARAM_U16, 0, 2000, 32)                            \
+    X(P_PID_D, "pid_d", PARAM_U16, 0, 2000, 0)                             \
+    X(P_PID_UPDATE_MS, "pid_update_ms", PARAM_U16, 20, 2000, 200)          \
+    X(P_SCALE_CPG, "scale_cpg", PARAM_U16, 1, 60000, 1000)                 \
+    X(P_FILL_FINE_PCT, "fill_fine_pct", PARAM_U8, 10, 100, 90)             \
+    X(P_FILL_SLOW_SPEED, "fill_slow_speed", PARAM_U16, 1, 2000, 100)       \
+    X(P_FILL_OFFSET_MG, "fill_offset_mg", PARAM_U16, 0, 10000, 0)          \
+    X(P_TRAY_STEPS, "tray_steps", PARAM_U16, 1, 60000, 1600)               \
+    X(P_INDEX_MAX_SPS, "index_max_sps", PARAM_U16, 50, 8000, 2000)         \
+    X(P_INDEX_ACCEL_S2, "index_accel_s2", PARAM_U16, 100, 60000, 4000)     \
+    X(P_AXIS2_MODE, "axis2_mode", PARAM_U8, 0, 1, 0)                       \
+    X(P_PUMP_B_PROFILE, "pump_b_profile", PARAM_U8, 0, 3, 1)
+
+#define PARAM_ENUM(index, name, type, minimum, maximum, initial) index,
+enum ParamIndex {
+    PARAMETERS(PARAM_ENUM)
+    PARAM_COUNT
+};
+#undef PARAM_ENUM
+
+const uint8_t PARAM_RECORD_COUNT = 32; // EEPROM records, at most one per parameter
+const uint8_t PARAM_TABLE_SIZE = 64;   // Power of two
+const uint8_t PARAM_SLOT_BITS = 6;
+const uint8_t PARAM_NAME_LENGTH = 16; // Including the terminator
+const uint16_t PARAM_HASH_SEED = 467;
+const uint8_t PARAM_NOT_FOUND = 0xFF;
+
+// FNV-1a of the name, folded to 16 bits
+constexpr uint16_t paramHash(const char *name, uint32_t hash = 2166136261UL) {
+    return *name ? paramHash(name + 1, (hash ^ (uint8_t)*name) * 16777619UL)
+                 : (uint16_t)(hash ^ (hash >> 16));
+}
+
+constexpr uint8_t paramSlot(uint16_t id) {
+    return (uint16_t)(id * PARAM_HASH_SEED) >> (16 - PARAM_SLOT_BITS);
+}
+
+extern int32_t paramValues[PARAM_COUNT];
+
+inline int32_t paramGet(ParamIndex index) {
+    return paramValues[index];
+}
+
+void loadParams();
+bool paramSet(uint8_t index, int32_t value); // Range checked, persisted
+uint8_t paramFind(uint16_t id);              // Index, or PARAM_NOT_FOUND
+uint8_t paramFind(const char *name);
+void printParam(Print &out, uint8_t index);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RECIPE_H
+#define RECIPE_H
+
+#include <Arduino.h>
+
+const uint8_t RECIPE_MAX_DOSES = 8;
+const uint8_t RECIPE_PUMPS = 2; // One per Timer1 compare channel
+
+// Multi-fluid recipes, scheduled as a dependency graph of doses.
+//
+// Each dose runs on one pump and can wait for earlier doses to finish. A
+// dose starts as soon as everything it waits for has finished and its pump
+// is free, so doses that do not depend on each other run together on
+// different pumps, and the recipe takes as long as its critical path rather
+// than the sum of its doses. When several doses are ready for the same
+// pump, the one heading the longest chain still to run goes first.
+//
+// This module only schedules. loop() starts the doses nextDose() hands out
+// on the step engines and reports them with finishDose().
+struct RecipeDose {
+    uint8_t pump;
+    float volume;  // ml
+    uint8_t after; // Bit per dose that has to finish first
+};
+
+void clearRecipe();
+bool addDose(uint8_t pump, float volume, uint8_t after); // false when full or after a later dose
+uint8_t recipeDoseCount();
+const RecipeDose &recipeDose(uint8_t dose);
+
+void beginRecipe(const uint32_t *durations); // Estimated ms per dose, for the priorities
+int8_t nextDose(uint8_t pump);               // Marks it started, -1 if none is ready
+void finishDose(uint8_t dose);
+bool isRecipeDone();
+uint8_t recipeDosesDone();
+uint32_t recipeCriticalPath(); // ms, longest chain of estimated durations
+
+#endif
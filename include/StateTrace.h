@@ -0,0 +1,70 @@
+#ifndef STATE_TRACE_H
+#define STATE_TRACE_H
+
+#include <Arduino.h>
+
+// Trace of state machine transitions, for finding out how the pump got into
+// a state after the fact.
+//
+// traceState() stores the time, both states and the cause in a RAM ring of
+// the last TRACE_SIZE transitions: a millis() read and a few stores with
+// interrupts off, so it may be called from ISRs.
+//
+// watchdogBegin() arms the watchdog in interrupt-then-reset mode. When
+// loop() stops calling watchdogKick(), the watchdog interrupt first copies
+// the newest TRACE_SAVED_SIZE entries to EEPROM and the board resets on the
+// next timeout. readSavedTrace() returns them after the restart. A hang
+// with interrupts disabled resets without saving.
+//
+// The old Nano bootloader does not survive a watchdog reset (it runs too
+// long with the watchdog still armed), so the firmware is built for
+// Optiboot (board nanoatmega328new) and needs it flashed on older boards.
+
+//  X(cause)
+#define TRACE_CAUSES(X)   \
+    X(BOOT)               \
+    X(LONG_PRESS)         \
+    X(FAST_PRESS)         \
+    X(MEDIUM_PRESS)       \
+    X(MENU_PRESS)         \
+    X(MENU_HOLD)          \
+    X(CALIBRATED)         \
+    X(PURGE_DONE)         \
+    X(DISPENSE_COMMAND)   \
+    X(DISPENSE_DONE)      \
+    X(PROFILE_SELECTED)   \
+    X(FAULT)              \
+    X(FAULT_CLEARED)      \
+    X(TRIGGER)
+
+#define TRACE_CAUSE_ENUM(name) CAUSE_##name,
+enum TraceCause : uint8_t {
+    TRACE_CAUSES(TRACE_CAUSE_ENUM)
+    CAUSE_COUNT
+};
+#undef TRACE_CAUSE_ENUM
+
+struct TraceEntry {
+    uint32_t time; // millis()
+    uint8_t from;
+    uint8_t to;
+    uint8_t cause;
+};
+
+const uint8_t TRACE_SIZE = 16;      // Power of two
+const uint8_t TRACE_SAVED_SIZE = 8; // Kept over a watchdog reset
+
+void traceState(uint8_t from, uint8_t to, uint8_t cause);
+
+// Entries oldest first, index 0 .. count - 1
+uint8_t traceCount();
+void readTrace(uint8_t index, TraceEntry &entry);
+uint8_t savedTraceCount();
+void readSavedTrace(uint8_t index, TraceEntry &entry);
+
+void printTraceCause(Print &out, uint8_t cause);
+
+void watchdogBegin();
+void watchdogKick();
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef STEP_ENGINE_H
+#define STEP_ENGINE_H
+
+#include <Arduino.h>
+
+// Interrupt-driven step generator on Timer1.
+//
+// Timer1 runs free at 0.5 us per tick (shared with the flow meter, see
+// Timer1.h). Each engine owns one output compare channel: its interrupt
+// raises the step pin at port level, plans the next interval and moves the
+// compare register on by it. Step timing therefore does not depend on
+// loop(), which may block on the display, EEPROM or serial output.
+//
+// Speeds ramp with constant acceleration using the integer form of Austin's
+// recurrence, c[n] = c[n-1] - 2 c[n-1] / (4n + 1), one division per step
+// while accelerating or decelerating and none at cruise. Intervals are kept
+// in 1/256 ticks so the ramp does not drift.
+//
+// Two kinds of motion:
+//
+//   move()           relative move with a trapezoidal profile: ramps up
+//                    to the maximum speed and down again to stop exactly
+//                    on the target. Called while running, it carries on
+//                    from the current speed, and a target behind or too
+//                    close to stop on is overshot within the acceleration
+//                    limit and then approached from the other side.
+//   runContinuous()  runs at a step interval, but never above the maximum
+//                    speed, until stop(). Calling it again while running
+//                    only replaces the target interval, and the interrupt
+//                    ramps to it within the acceleration limit, so it is
+//                    cheap enough to call every loop(). Reversing needs a
+//                    stop() first.
+//
+// Up to MAX_BANDS resonance bands can be set, speeds where the pump loses
+// steps. Ramps cross a band at twice the acceleration, and the engine never
+// cruises inside one: move() cruises at the bottom of a band the maximum
+// speed falls in, runContinuous() at the nearer edge.
+//
+// preload() stores a relative move for startPreloaded() to start later
+// from an interrupt, with nothing left to compute there: the first step
+// follows 16 us after it.
+//
+// setStepHook() runs a function in the interrupt right after each pulse.
+class StepEngine {
+public:
+    static const uint32_t TICKS_PER_SECOND = 2000000;
+    static const uint8_t MAX_BANDS = 2;
+
+    StepEngine(uint8_t stepPin, uint8_t dirPin, uint8_t channel);
+
+    void begin();
+    void setMaxSpeed(float stepsPerSecond);
+    void setAcceleration(float stepsPerSecond2);
+    void setStepHook(void (*hook)());
+    void setBand(uint8_t index, uint16_t low, uint16_t high); // steps/s, low >= high clears it
+
+    void move(long steps);
+    void preload(long steps);  // 0 clears it
+    bool startPreloaded();     // From an interrupt. false if running or nothing preloaded.
+    bool isPreloaded() const;
+    void runContinuous(bool isForward, uint32_t interval);
+    void stop();     // Ramp down and stop
+    void hardStop(); // Stop at once, without a ramp. Safe from ISRs.
+
+    // Stops at once and makes the step pin an input. Until enableOutput(),
+    // move(), runContinuous() and startPreloaded() do nothing, so a start
+    // racing the E-stop cannot pulse it. Safe from ISRs.
+    void disableOutput();
+    void enableOutput();
+
+    long currentPosition() const;
+    void setCurrentPosition(long position); // Stops first
+    long distanceToGo() const;              // 0 unless in a move()
+    bool isRunning() const;
+    uint32_t interval() const;              // Ticks between steps, 0 when stopped
+
+    // The band an interval in ticks falls inside, edges in steps/s
+    bool bandAround(uint32_t interval, uint16_t &low, uint16_t &high) const;
+    uint16_t cruiseSpeed(uint16_t speed) const; // Lowered to the bottom of a band it falls in
+
+    static uint32_t intervalFor(float stepsPerSecond);
+    static uint16_t ticks(); // Timer1 count
+
+    void onCompare(); // Called from the compare interrupt
+
+private:
+    enum Mode : uint8_t {
+        STOPPED,
+        MOVING,
+        CONTINUOUS,
+        STOPPING
+    };
+
+    void start(bool isForward);
+    uint32_t step();
+    void accelerate(uint32_t limit);
+    void decelerate(uint32_t limit);
+    void rampUp();
+    void rampDown();
+    int8_t bandIndex(uint32_t interval) const; // -1 outside all bands
+    uint32_t outsideBands(uint32_t interval) const;
+    void updateCruise();
+    void scheduleNext();
+    void setDirection(bool isForward);
+    void pulseHigh();
+    void pulseLow();
+
+    uint8_t stepPin;
+    uint8_t dirPin;
+    uint8_t channel;
+    volatile uint8_t *stepPort;
+    volatile uint8_t *stepMode;
+    uint8_t stepMask;
+
+    void (*stepHook)();
+
+    // Shared with the interrupt
+    volatile Mode mode;
+    volatile int8_t direction;
+    volatile long position;
+    volatile long target;
+    volatile uint32_t current;   // Interval after the next step, 1/256 ticks
+    volatile uint32_t minimum;   // At maximum speed, 1/256 ticks
+    volatile uint32_t cruise;    // minimum, or the slow edge of a band it falls in
+    volatile uint32_t goal;      // Continuous interval, 1/256 ticks
+    volatile uint32_t rampStep;  // n in the recurrence: steps into the ramp
+    volatile uint32_t braking;   // Steps a stop from here takes, below n after a band
+    volatile uint32_t remaining; // Ticks left of an interval over 16 bits
+    volatile long preloaded;
+    volatile bool isDisabled;
+    uint32_t first;              // c[0], 1/256 ticks
+    uint16_t bandLow[MAX_BANDS];  // steps/s
+    uint16_t bandHigh[MAX_BANDS];
+    uint32_t bandFast[MAX_BANDS]; // Edge intervals, 1/256 ticks: inside is
+    uint32_t bandSlow[MAX_BANDS]; // strictly between, empty when cleared
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef TIMER1_H
+#define TIMER1_H
+
+#include <Arduino.h>
+
+const uint8_t TIMER1_TICKS_PER_US = 2;
+
+// Timer1, shared by the step engines and the flow meter.
+//
+// It runs free in normal mode at 0.5 us per tick and is never stopped,
+// reloaded or given another clock, so every user can take differences of
+// its count. The parts of it belong to:
+//
+//   compare A, OCR1A      StepEngine channel 0, the pump
+//   compare B, OCR1B      StepEngine channel 1, the indexer or second pump
+//   input capture, ICR1   FlowSensor, rising edges on ICP1 (D8)
+//   overflow              FlowSensor, extends captures to 32 bits
+//
+// The compare outputs stay disconnected, the step pins are driven as port
+// pins. Each user enables only its own interrupts in TIMSK1.
+//
+// beginTimer1() replaces Arduino's setup of the timer (prescaler 64, phase
+// correct PWM) as a whole. Every user calls it from its begin function, in
+// any order.
+void beginTimer1();
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef TRIGGER_INPUT_H
+#define TRIGGER_INPUT_H
+
+#include <Arduino.h>
+
+const uint8_t TRIGGER_PIN = 4; // PD4, PCINT20
+
+// Container sensor on the conveyor, on a pin-change interrupt.
+//
+// The sensor pulls the input low while a container passes it. The pin
+// change interrupt calls the handler on that falling edge, so a dispense
+// can start from the interrupt, a few microseconds after the edge, rather
+// than whenever loop() next looks. The rising edge is ignored.
+//
+// INT0 and INT1 are taken by the button and the E-stop. Only PCINT20 is
+// enabled in its group, so the other port D pins never raise this
+// interrupt.
+void beginTriggerInput(void (*handler)()); // Handler runs in the interrupt
+bool isTriggerActive();
+
+#endif
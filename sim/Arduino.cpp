@@ -0,0 +1,369 @@
+#include "Arduino.h"
+#include "Sim.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+
+HardwareSerial Serial;
+
+static double clockSpeed = 1.0;
+static uint8_t pinLevels[NUM_DIGITAL_PINS];
+static uint8_t pinModes[NUM_DIGITAL_PINS];
+static bool isDriven[NUM_DIGITAL_PINS]; // Set with simSetPin(), wins over the pull-up
+static unsigned long risingEdges[NUM_DIGITAL_PINS];
+static int analogValues[8] = {512, 512, 512, 512, 512, 512, 512, 512};
+
+static SimTicker ticker = NULL;
+static bool areInterruptsEnabled = true;
+static bool isTicking = false; // The ticker reads the time too
+
+struct InterruptHandler {
+    void (*handler)();
+    int mode;
+};
+static InterruptHandler interruptHandlers[2];
+
+static int serialFd = -1;
+static int serialSlaveFd = -1;
+static uint8_t rxBuffer[64];
+static uint8_t rxHead = 0;
+static uint8_t rxCount = 0;
+
+// UART pacing in virtual time: one byte is ten bit times at the baud rate
+static unsigned long byteTimeUs = 0;
+static unsigned long rxArrival = 0; // When the next received byte is complete
+static unsigned long txDoneAt = 0;  // When the transmit buffer is empty
+const unsigned long TX_BUFFER_SIZE = 64;
+
+// Bytes on their way out, with the time their stop bit is sent
+struct TxByte {
+    unsigned long doneAt;
+    uint8_t value;
+};
+static std::deque<TxByte> txQueue;
+
+static void flushTransmitted() {
+    // Hand bytes to the host only once they would have crossed the wire
+    unsigned long now = micros();
+    uint8_t buffer[TX_BUFFER_SIZE];
+    size_t n = 0;
+    while (!txQueue.empty() && (long)(now - txQueue.front().doneAt) >= 0 && n < sizeof(buffer)) {
+        buffer[n++] = txQueue.front().value;
+        txQueue.pop_front();
+    }
+    if (n > 0 && serialFd >= 0) {
+        // Drop output nobody reads instead of stalling the device
+        ssize_t written = ::write(serialFd, buffer, n);
+        (void)written;
+    }
+}
+
+// Virtual clock
+
+uint64_t simHostMicros() {
+    static timespec start = {0, 0};
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) {
+        start = now;
+    }
+    return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void simSetClockSpeed(double speed) {
+    clockSpeed = speed;
+}
+
+void simAttachTicker(SimTicker newTicker) {
+    ticker = newTicker;
+}
+
+unsigned long micros() {
+    unsigned long now = (unsigned long)(simHostMicros() * clockSpeed);
+    if (ticker != NULL && areInterruptsEnabled && !isTicking) {
+        isTicking = true;
+        ticker();
+        isTicking = false;
+    }
+    return now;
+}
+
+unsigned long millis() {
+    return micros() / 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+    unsigned long start = micros();
+    while (micros() - start < us) {
+        yield();
+    }
+}
+
+void delay(unsigned long ms) {
+    unsigned long start = micros();
+    while (micros() - start < ms * 1000) {
+        yield();
+    }
+}
+
+void yield() {
+    sched_yield();
+}
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh) {
+    return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
+
+// Pins
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= NUM_DIGITAL_PINS) {
+        return;
+    }
+    pinModes[pin] = mode;
+    if (mode == INPUT_PULLUP && !isDriven[pin]) {
+        pinLevels[pin] = HIGH;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < NUM_DIGITAL_PINS) {
+        if (value && pinLevels[pin] == LOW) {
+            risingEdges[pin]++;
+        }
+        pinLevels[pin] = value ? HIGH : LOW;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < NUM_DIGITAL_PINS ? pinLevels[pin] : LOW;
+}
+
+int analogRead(uint8_t pin) {
+    if (pin >= A0) {
+        pin -= A0;
+    }
+    return pin < 8 ? analogValues[pin] : 0;
+}
+
+void simSetPin(uint8_t pin, uint8_t level) {
+    if (pin >= NUM_DIGITAL_PINS) {
+        return;
+    }
+    isDriven[pin] = true;
+    if (pinLevels[pin] == level) {
+        return;
+    }
+    pinLevels[pin] = level;
+
+    int interrupt = digitalPinToInterrupt(pin);
+    if (interrupt < 0 || interruptHandlers[interrupt].handler == NULL) {
+        return;
+    }
+    int mode = interruptHandlers[interrupt].mode;
+    if (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)) {
+        interruptHandlers[interrupt].handler();
+    }
+}
+
+void simSetAnalog(uint8_t pin, int value) {
+    if (pin >= A0) {
+        pin -= A0;
+    }
+    if (pin < 8) {
+        analogValues[pin] = constrain(value, 0, 1023);
+    }
+}
+
+unsigned long simRisingEdges(uint8_t pin) {
+    return pin < NUM_DIGITAL_PINS ? risingEdges[pin] : 0;
+}
+
+int simGetAnalog(uint8_t pin) {
+    return analogRead(pin);
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode) {
+    if (interrupt < 2) {
+        interruptHandlers[interrupt].handler = handler;
+        interruptHandlers[interrupt].mode = mode;
+    }
+}
+
+void detachInterrupt(uint8_t interrupt) {
+    if (interrupt < 2) {
+        interruptHandlers[interrupt].handler = NULL;
+    }
+}
+
+void interrupts() {
+    areInterruptsEnabled = true;
+}
+
+void noInterrupts() {
+    areInterruptsEnabled = false;
+}
+
+// Print
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(const __FlashStringHelper *text) {
+    return write(reinterpret_cast<const char *>(text));
+}
+
+size_t Print::print(const String &text) {
+    return write(text.c_str(), text.length());
+}
+
+size_t Print::print(const char *text) {
+    return write(text);
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base) {
+    return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base) {
+    if (value < 0 && base == DEC) {
+        return print('-') + printNumber(-value, base);
+    }
+    return printNumber(value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return print(buffer);
+}
+
+size_t Print::println() {
+    return write("\r\n");
+}
+
+size_t Print::printNumber(unsigned long value, int base) {
+    char buffer[8 * sizeof(long) + 1];
+    char *p = &buffer[sizeof(buffer) - 1];
+    *p = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        int digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value > 0);
+    return write(p);
+}
+
+// Serial port
+
+const char *simOpenSerial() {
+    serialFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (serialFd < 0 || grantpt(serialFd) != 0 || unlockpt(serialFd) != 0) {
+        return NULL;
+    }
+    const char *path = ptsname(serialFd);
+
+    // Hold the slave open so the master never sees a hangup between clients,
+    // and make the line raw like a real UART
+    serialSlaveFd = open(path, O_RDWR | O_NOCTTY);
+    termios tio;
+    if (serialSlaveFd >= 0 && tcgetattr(serialSlaveFd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(serialSlaveFd, TCSANOW, &tio);
+    }
+    fcntl(serialFd, F_SETFL, fcntl(serialFd, F_GETFL) | O_NONBLOCK);
+    return path;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    byteTimeUs = baud > 0 ? 10000000UL / baud : 0;
+}
+
+int HardwareSerial::available() {
+    flushTransmitted();
+    unsigned long now = micros();
+    if (rxCount == 0 && serialFd >= 0) {
+        ssize_t n = ::read(serialFd, rxBuffer, sizeof(rxBuffer));
+        rxHead = 0;
+        rxCount = n > 0 ? n : 0;
+        if (rxCount > 0 && (long)(rxArrival - now) < 0) {
+            rxArrival = now + byteTimeUs; // Line was idle
+        }
+    }
+    // Bytes become readable one byte time apart, as off a real UART
+    if (rxCount > 0 && (long)(now - rxArrival) < 0) {
+        return 0;
+    }
+    return rxCount;
+}
+
+int HardwareSerial::read() {
+    if (available() == 0) {
+        return -1;
+    }
+    rxCount--;
+    rxArrival += byteTimeUs;
+    return rxBuffer[rxHead++];
+}
+
+int HardwareSerial::peek() {
+    return available() > 0 ? rxBuffer[rxHead] : -1;
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        // Block like the firmware does when the transmit buffer is full
+        while (txQueue.size() >= TX_BUFFER_SIZE) {
+            flushTransmitted();
+            yield();
+        }
+        unsigned long now = micros();
+        if ((long)(txDoneAt - now) < 0) {
+            txDoneAt = now; // Line was idle
+        }
+        txDoneAt += byteTimeUs;
+        TxByte byte = {txDoneAt, buffer[i]};
+        txQueue.push_back(byte);
+    }
+    flushTransmitted();
+    return size;
+}
+
+int HardwareSerial::availableForWrite() {
+    flushTransmitted();
+    return TX_BUFFER_SIZE - 1 - txQueue.size();
+}
@@ -0,0 +1,56 @@
+#include "EEPROM.h"
+#include "Sim.h"
+
+#include <stdio.h>
+
+EEPROMClass EEPROM;
+
+static uint8_t cells[E2END + 1];
+static bool isLoaded = false;
+static FILE *backingFile = NULL;
+
+static void ensureLoaded() {
+    if (!isLoaded) {
+        memset(cells, 0xFF, sizeof(cells)); // Erased
+        isLoaded = true;
+    }
+}
+
+void simLoadEeprom(const char *path) {
+    ensureLoaded();
+    backingFile = fopen(path, "r+b");
+    if (backingFile == NULL) {
+        backingFile = fopen(path, "w+b");
+        if (backingFile != NULL) {
+            fwrite(cells, 1, sizeof(cells), backingFile);
+            fflush(backingFile);
+        }
+    } else {
+        size_t n = fread(cells, 1, sizeof(cells), backingFile);
+        (void)n; // A short file leaves the rest erased
+    }
+}
+
+uint8_t EEPROMClass::read(int address) {
+    ensureLoaded();
+    return address >= 0 && address <= E2END ? cells[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    ensureLoaded();
+    if (address < 0 || address > E2END) {
+        return;
+    }
+    cells[address] = value;
+    if (backingFile != NULL) {
+        fseek(backingFile, address, SEEK_SET);
+        fputc(value, backingFile);
+        fflush(backingFile);
+    }
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+    if (read(address) != value) {
+        write(address, value);
+    }
+}
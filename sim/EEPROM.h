@@ -0,0 +1,37 @@
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include "Arduino.h"
+
+#define E2END 0x3FF
+
+// EEPROM of the virtual device, optionally backed by a file (see Sim.h)
+class EEPROMClass {
+public:
+    uint8_t read(int address);
+    void write(int address, uint8_t value);
+    void update(int address, uint8_t value);
+    uint16_t length() { return E2END + 1; }
+
+    template <typename T>
+    T &get(int address, T &value) {
+        uint8_t *bytes = (uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = read(address + i);
+        }
+        return value;
+    }
+
+    template <typename T>
+    const T &put(int address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            update(address + i, bytes[i]);
+        }
+        return value;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// Controls of the virtual device, used by the native entry point.
+
+// Virtual clock: micros() runs at speed times host time
+void simSetClockSpeed(double speed);
+uint64_t simHostMicros();
+
+// Serial port on a pseudo-terminal. Returns the slave path, or NULL.
+const char *simOpenSerial();
+
+// Inputs. A level set with simSetPin() overrides the pin's pull-up.
+void simSetPin(uint8_t pin, uint8_t level);
+void simSetAnalog(uint8_t pin, int value);
+int simGetAnalog(uint8_t pin);
+
+// Outputs: number of low to high transitions the firmware wrote to a pin
+unsigned long simRisingEdges(uint8_t pin);
+
+// Timer interrupts: the ticker is called from micros(), so it also runs
+// while the firmware busy-waits, and not between noInterrupts() and
+// interrupts()
+typedef void (*SimTicker)();
+void simAttachTicker(SimTicker ticker);
+
+// EEPROM contents persisted to a file between runs (optional)
+void simLoadEeprom(const char *path);
+
+// LCD emulation: draws the 16x2 screen on the terminal when it changed
+bool simLcdChanged();
+void simRenderLcd();
+
+#endif
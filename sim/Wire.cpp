@@ -0,0 +1,118 @@
+#include "Wire.h"
+#include "Sim.h"
+
+#include <stdio.h>
+
+TwoWire Wire;
+
+// PCF8574 outputs as wired on the backpack
+const uint8_t EXPANDER_RS = 0x01;
+const uint8_t EXPANDER_EN = 0x04;
+
+const uint8_t LCD_COLS = 16;
+const uint8_t LCD_ROWS = 2;
+
+// HD44780 state
+static uint8_t ddram[LCD_ROWS][40];
+static uint8_t address = 0;
+static bool isFourBit = false;
+static bool hasHighNibble = false;
+static uint8_t highNibble = 0;
+static uint8_t lastExpander = 0;
+static bool isChanged = true;
+
+static struct LcdPowerUp {
+    LcdPowerUp() { memset(ddram, ' ', sizeof(ddram)); }
+} lcdPowerUp;
+
+static void lcdExecute(uint8_t value, bool isData) {
+    uint8_t row = address >= 0x40 ? 1 : 0;
+    uint8_t col = address & 0x3F;
+
+    if (isData) {
+        if (col < 40) {
+            ddram[row][col] = value;
+            isChanged = true;
+        }
+        address = (address & 0x40) | ((col + 1) % 40);
+    } else if (value & 0x80) {
+        address = value & 0x7F;
+    } else if (value & 0x20) {
+        isFourBit = (value & 0x10) == 0;
+    } else if (value == 0x01) {
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+        isChanged = true;
+    } else if ((value & 0xFE) == 0x02) {
+        address = 0;
+    }
+}
+
+static void expanderOutput(uint8_t bits) {
+    // The controller latches D4-D7 on the falling edge of EN
+    bool isFalling = (lastExpander & EXPANDER_EN) && !(bits & EXPANDER_EN);
+    lastExpander = bits;
+    if (!isFalling) {
+        return;
+    }
+
+    uint8_t nibble = bits & 0xF0;
+    bool isData = bits & EXPANDER_RS;
+    if (!isFourBit) {
+        // 8-bit mode during reset, the low data lines are not connected
+        hasHighNibble = false;
+        lcdExecute(nibble, isData);
+    } else if (!hasHighNibble) {
+        highNibble = nibble;
+        hasHighNibble = true;
+    } else {
+        hasHighNibble = false;
+        lcdExecute(highNibble | (nibble >> 4), isData);
+    }
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    (void)address;
+    length = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+    (void)sendStop;
+    for (uint8_t i = 0; i < length; ++i) {
+        expanderOutput(buffer[i]);
+    }
+    length = 0;
+    return 0;
+}
+
+size_t TwoWire::write(uint8_t value) {
+    if (length >= BUFFER_LENGTH) {
+        return 0;
+    }
+    buffer[length++] = value;
+    return 1;
+}
+
+bool simLcdChanged() {
+    return isChanged;
+}
+
+void simRenderLcd() {
+    isChanged = false;
+
+    printf("\033[1;1H+----------------+\n");
+    for (uint8_t row = 0; row < LCD_ROWS; ++row) {
+        putchar('|');
+        for (uint8_t col = 0; col < LCD_COLS; ++col) {
+            uint8_t c = ddram[row][col];
+            if (c == 0xFF) {
+                fputs("█", stdout); // Full block
+            } else {
+                putchar(c >= ' ' && c <= '~' ? c : '?');
+            }
+        }
+        printf("|\n");
+    }
+    printf("+----------------+\n");
+    fflush(stdout);
+}
@@ -0,0 +1,30 @@
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+// I2C bus of the virtual device. The only device on it is the PCF8574 LCD
+// backpack, emulated down to the HD44780 nibble protocol.
+class TwoWire : public Stream {
+public:
+    void begin() {}
+    void setClock(uint32_t clock) { (void)clock; }
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool sendStop = true);
+
+    size_t write(uint8_t value) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+private:
+    uint8_t buffer[BUFFER_LENGTH];
+    uint8_t length;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,225 @@
+// Entry point of the native build: runs the firmware as a virtual device.
+//
+//   pump-sim [--speed N] [--eeprom FILE] [--link PATH]
+//
+// The serial port is a pseudo-terminal (its path is printed, --link adds a
+// stable symlink to it), the LCD is drawn at the top of this terminal, and
+// the keyboard stands in for the front panel:
+//
+//   space  press / release the button
+//   + -    turn the potentiometer
+//   o      block / unblock the tube (raises the motor current sense)
+//   d      empty / refill the reservoir
+//   e      press / release the E-stop
+//   t      a container passes the trigger sensor
+//   q      quit
+
+#include "Arduino.h"
+#include "Sim.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+void flowSensorPulse(); // FlowSensor.cpp
+void stepEngineTick();  // StepEngine.cpp
+void loadCellSample(int32_t raw); // LoadCell.cpp
+void dryRunSensorChange();        // DryRunSensor.cpp
+void triggerInputChange();        // TriggerInput.cpp
+
+const uint8_t SIM_BUTTON_PIN = 2;
+const uint8_t SIM_STEP_PIN = 5;
+const uint8_t SIM_INDEXER_STEP_PIN = 9;
+const uint8_t SIM_ESTOP_PIN = 3;
+const uint8_t SIM_DRY_RUN_PIN = 7;
+const uint8_t SIM_TRIGGER_PIN = 4;
+const uint8_t SIM_POTENTIOMETER_PIN = A1;
+const int SIM_POTENTIOMETER_STEP = 32;
+const uint8_t SIM_CURRENT_SENSE_PIN = A2;
+const int SIM_CURRENT_NORMAL = 300;
+const int SIM_CURRENT_OCCLUDED = 600;
+const unsigned long SIM_RENDER_INTERVAL_US = 50000;
+
+// The simulated pump moves 1/420 ml per step, a little more than the
+// default calibration assumes, and the flow meter gives 5880 pulses per litre
+const double SIM_METER_PULSES_PER_STEP = 5.88 / 420;
+
+// Water into a vessel on a 1000 counts/g load cell, sampled at 80 Hz
+const double SIM_SCALE_COUNTS_PER_STEP = 1000.0 / 420;
+const int32_t SIM_SCALE_ZERO = 84000; // Empty vessel
+const int SIM_SCALE_NOISE = 20;       // Counts either way
+const unsigned long SIM_SCALE_INTERVAL_US = 12500;
+
+static termios savedTerminal;
+static bool isTerminalSaved = false;
+
+static void restoreTerminal() {
+    if (isTerminalSaved) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+    }
+    printf("\033[r\n");
+}
+
+static void handleSignal(int) {
+    exit(0);
+}
+
+static void setupKeyboard() {
+    if (tcgetattr(STDIN_FILENO, &savedTerminal) != 0) {
+        return; // Not a terminal
+    }
+    isTerminalSaved = true;
+    termios tio = savedTerminal;
+    tio.c_lflag &= ~(ICANON | ECHO);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+}
+
+static bool handleKeyboard() {
+    char key;
+    while (read(STDIN_FILENO, &key, 1) == 1) {
+        switch (key) {
+            case ' ':
+                simSetPin(SIM_BUTTON_PIN, digitalRead(SIM_BUTTON_PIN) == HIGH ? LOW : HIGH);
+                break;
+            case '+':
+                simSetAnalog(SIM_POTENTIOMETER_PIN, simGetAnalog(SIM_POTENTIOMETER_PIN) + SIM_POTENTIOMETER_STEP);
+                break;
+            case '-':
+                simSetAnalog(SIM_POTENTIOMETER_PIN, simGetAnalog(SIM_POTENTIOMETER_PIN) - SIM_POTENTIOMETER_STEP);
+                break;
+            case 'o':
+                simSetAnalog(SIM_CURRENT_SENSE_PIN, simGetAnalog(SIM_CURRENT_SENSE_PIN) == SIM_CURRENT_OCCLUDED
+                                                        ? SIM_CURRENT_NORMAL
+                                                        : SIM_CURRENT_OCCLUDED);
+                break;
+            case 'd':
+                simSetPin(SIM_DRY_RUN_PIN, digitalRead(SIM_DRY_RUN_PIN) == HIGH ? LOW : HIGH);
+                dryRunSensorChange();
+                break;
+            case 'e':
+                simSetPin(SIM_ESTOP_PIN, digitalRead(SIM_ESTOP_PIN) == HIGH ? LOW : HIGH);
+                break;
+            case 't':
+                simSetPin(SIM_TRIGGER_PIN, LOW);
+                triggerInputChange();
+                simSetPin(SIM_TRIGGER_PIN, HIGH);
+                triggerInputChange();
+                break;
+            case 'q':
+                return false;
+        }
+    }
+    return true;
+}
+
+static void simulateFlowMeter() {
+    static unsigned long lastSteps = 0;
+    static double pulses = 0;
+
+    unsigned long steps = simRisingEdges(SIM_STEP_PIN);
+    pulses += (steps - lastSteps) * SIM_METER_PULSES_PER_STEP;
+    lastSteps = steps;
+    while (pulses >= 1) {
+        pulses -= 1;
+        flowSensorPulse();
+    }
+}
+
+static void simulateLoadCell() {
+    static unsigned long lastSample = 0;
+    unsigned long now = micros();
+    if (now - lastSample < SIM_SCALE_INTERVAL_US) {
+        return;
+    }
+    lastSample = now;
+    double counts = simRisingEdges(SIM_STEP_PIN) * SIM_SCALE_COUNTS_PER_STEP;
+    loadCellSample(SIM_SCALE_ZERO + (int32_t)counts + rand() % (2 * SIM_SCALE_NOISE + 1) - SIM_SCALE_NOISE);
+}
+
+static void renderStatus(unsigned long loops, unsigned long elapsed) {
+    // Loop rate in virtual time
+    printf("\033[5;1Ht=%.3fs  %lu loops/s  button %s  pot %d  current %d  reservoir %s  tray %lu\033[K\n",
+           micros() / 1e6, elapsed > 0 ? (unsigned long)(loops * 1e6 / elapsed) : 0,
+           digitalRead(SIM_BUTTON_PIN) == LOW ? "down" : "up", simGetAnalog(SIM_POTENTIOMETER_PIN),
+           simGetAnalog(SIM_CURRENT_SENSE_PIN), digitalRead(SIM_DRY_RUN_PIN) == HIGH ? "full" : "empty",
+           simRisingEdges(SIM_INDEXER_STEP_PIN));
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *link = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            simSetClockSpeed(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--eeprom") == 0 && i + 1 < argc) {
+            simLoadEeprom(argv[++i]);
+        } else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+            link = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--speed N] [--eeprom FILE] [--link PATH]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const char *path = simOpenSerial();
+    if (path == NULL) {
+        perror("pseudo-terminal");
+        return 1;
+    }
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(path, link) != 0) {
+            perror(link);
+        }
+    }
+
+    setupKeyboard();
+    atexit(restoreTerminal);
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    printf("\033[2J\033[6;1HSerial port: %s\n", link != NULL ? link : path);
+    printf("space: button  +/-: potentiometer  o: occlusion  d: reservoir  e: E-stop  t: trigger  q: quit\n");
+
+    simSetAnalog(SIM_CURRENT_SENSE_PIN, SIM_CURRENT_NORMAL);
+    simSetPin(SIM_DRY_RUN_PIN, HIGH); // Liquid present
+    simSetPin(SIM_ESTOP_PIN, LOW);    // Released, door closed
+    simAttachTicker(stepEngineTick); // Timer1 compare interrupts
+    setup();
+
+    // Rendering and the keyboard run on host time, whatever the clock speed
+    unsigned long loops = 0;
+    unsigned long windowStart = micros();
+    uint64_t lastRender = 0;
+    while (true) {
+        loop();
+        simulateFlowMeter();
+        simulateLoadCell();
+        loops++;
+
+        unsigned long now = micros();
+        if (simHostMicros() - lastRender >= SIM_RENDER_INTERVAL_US) {
+            if (!handleKeyboard()) {
+                break;
+            }
+            if (simLcdChanged()) {
+                simRenderLcd();
+            }
+            renderStatus(loops, now - windowStart);
+            lastRender = simHostMicros();
+            if (now - windowStart >= 1000000) {
+                loops = 0;
+                windowStart = now;
+            }
+        }
+    }
+    return 0;
+}
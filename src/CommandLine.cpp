@@ -0,0 +1,26 @@
+#include "CommandLine.h"
+
+CommandLine::CommandLine(Stream &stream) : stream(stream), length(0), isOverflowed(false), wasOverflowed(false) {
+}
+
+char *CommandLine::poll() {
+    while (stream.available() > 0) {
+        char c = stream.read();
+
+        if (c == '\n' || c == '\r') {
+            bool isComplete = length > 0;
+            buffer[length] = '\0';
+            length = 0;
+            wasOverflowed = isOverflowed;
+            isOverflowed = false;
+            if (isComplete) {
+                return buffer;
+            }
+        } else if (length < MAX_LENGTH) {
+            buffer[length++] = c;
+        } else {
+            isOverflowed = true;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,48 @@
+#include "DryRunSensor.h"
+
+static void (*dryHandler)() = NULL;
+
+#ifdef __AVR__
+
+void beginDryRunSensor(void (*handler)()) {
+    dryHandler = handler;
+    pinMode(DRY_RUN_SENSOR_PIN, INPUT);
+    DIDR1 = _BV(AIN1D); // Analog only, saves the input buffer current
+    // Bandgap on the positive input, interrupt when the output rises, that
+    // is when the sensor drops below the bandgap
+    ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIS1) | _BV(ACIS0);
+    ACSR |= _BV(ACIE);
+}
+
+ISR(ANALOG_COMP_vect) {
+    // The output may still be settling after the bandgap was switched in,
+    // so act on the level rather than the edge alone
+    if ((ACSR & _BV(ACO)) && dryHandler != NULL) {
+        dryHandler();
+    }
+}
+
+bool isReservoirEmpty() {
+    return ACSR & _BV(ACO);
+}
+
+#else
+
+// The virtual device has a digital level on the pin and calls this when
+// it changes
+void dryRunSensorChange() {
+    if (isReservoirEmpty() && dryHandler != NULL) {
+        dryHandler();
+    }
+}
+
+void beginDryRunSensor(void (*handler)()) {
+    dryHandler = handler;
+    pinMode(DRY_RUN_SENSOR_PIN, INPUT);
+}
+
+bool isReservoirEmpty() {
+    return digitalRead(DRY_RUN_SENSOR_PIN) == LOW;
+}
+
+#endif
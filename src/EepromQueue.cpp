@@ -0,0 +1,132 @@
+#include "EepromQueue.h"
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#else
+#include <EEPROM.h>
+#endif
+
+EepromQueue eepromQueue;
+
+EepromQueue::EepromQueue() : head(0), count(0), writing(false) {
+}
+
+#ifdef __AVR__
+
+void EepromQueue::write(uint16_t address, uint8_t value) {
+    // Queue full: wait for the interrupt to make room
+    while (count == QUEUE_SIZE) {
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t tail = (head + count) % QUEUE_SIZE;
+        addresses[tail] = address;
+        values[tail] = value;
+        count++;
+        EECR |= _BV(EERIE); // Fires as soon as the EEPROM is not busy
+    }
+}
+
+void EepromQueue::holdWrites() const {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        EECR &= ~_BV(EERIE);
+    }
+    // EEAR cannot be loaded while a byte is programmed, at most 3.4 ms
+    while (EECR & _BV(EEPE)) {
+    }
+}
+
+uint8_t EepromQueue::readHeld(uint16_t address) const {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Newest queued value wins, including the one just programmed
+        for (uint8_t i = count; i > 0; --i) {
+            uint8_t index = (head + i - 1) % QUEUE_SIZE;
+            if (addresses[index] == address) {
+                return values[index];
+            }
+        }
+    }
+    return eeprom_read_byte((const uint8_t *)(uintptr_t)address);
+}
+
+void EepromQueue::releaseWrites() const {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (count > 0) {
+            EECR |= _BV(EERIE); // onReady() retires the byte programmed before the hold
+        }
+    }
+}
+
+uint8_t EepromQueue::read(uint16_t address) const {
+    holdWrites();
+    uint8_t value = readHeld(address);
+    releaseWrites();
+    return value;
+}
+
+bool EepromQueue::isIdle() const {
+    return count == 0;
+}
+
+void EepromQueue::onReady() {
+    if (writing) {
+        // The previous byte has been programmed
+        writing = false;
+        head = (head + 1) % QUEUE_SIZE;
+        count--;
+    }
+
+    while (count > 0) {
+        EEAR = addresses[head];
+        EECR |= _BV(EERE);
+        if (EEDR != values[head]) {
+            EEDR = values[head];
+            EECR |= _BV(EEMPE);
+            EECR |= _BV(EEPE); // Must follow EEMPE within four cycles
+            writing = true;
+            return;
+        }
+        // Already holds the value
+        head = (head + 1) % QUEUE_SIZE;
+        count--;
+    }
+
+    EECR &= ~_BV(EERIE);
+}
+
+ISR(EE_READY_vect) {
+    eepromQueue.onReady();
+}
+
+#else
+
+// Native build: no EE_READY interrupt, the virtual EEPROM is written at once
+
+void EepromQueue::write(uint16_t address, uint8_t value) {
+    EEPROM.update(address, value);
+}
+
+uint8_t EepromQueue::read(uint16_t address) const {
+    return EEPROM.read(address);
+}
+
+void EepromQueue::holdWrites() const {
+}
+
+uint8_t EepromQueue::readHeld(uint16_t address) const {
+    return EEPROM.read(address);
+}
+
+void EepromQueue::releaseWrites() const {
+}
+
+bool EepromQueue::isIdle() const {
+    return true;
+}
+
+void EepromQueue::onReady() {
+}
+
+#endif
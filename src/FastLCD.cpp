@@ -0,0 +1,305 @@
+#include "FastLCD.h"
+
+#include <Wire.h>
+
+#ifndef BUFFER_LENGTH
+#define BUFFER_LENGTH 32
+#endif
+
+// PCF8574 pin mapping used by the common backpacks
+const uint8_t LCD_RS = 0x01;
+const uint8_t LCD_EN = 0x04;
+const uint8_t LCD_BACKLIGHT = 0x08;
+
+// HD44780 instructions
+const uint8_t LCD_CLEAR = 0x01;
+const uint8_t LCD_HOME = 0x02;
+const uint8_t LCD_ENTRY_MODE = 0x06;   // Increment, no shift
+const uint8_t LCD_DISPLAY_ON = 0x0C;   // Display on, cursor off, blink off
+const uint8_t LCD_FUNCTION_SET = 0x28; // 4-bit bus, 2 lines, 5x8 font
+const uint8_t LCD_SET_DDRAM = 0x80;
+
+const uint32_t LCD_I2C_CLOCK = 400000;
+
+// Controller timing, in units of 100 us for LCD_OP_WAIT
+const unsigned long LCD_POWER_UP_US = 50000; // After Vcc rises, counted from boot
+const uint8_t LCD_RESET_WAIT = 45;           // 4.5 ms after the first reset nibbles
+const uint8_t LCD_RESET_SHORT_WAIT = 2;      // 150 us after the third
+const uint8_t LCD_CLEAR_WAIT = 16;           // 1.52 ms for clear
+const unsigned int LCD_WAIT_UNIT_US = 100;
+
+// Queued operations
+const uint8_t LCD_OP_DATA = 0;
+const uint8_t LCD_OP_COMMAND = 1;
+const uint8_t LCD_OP_NIBBLE = 2; // Single nibble, only used by the reset sequence
+const uint8_t LCD_OP_WAIT = 3;   // Controller busy for value * 100 us
+
+// A character is two nibbles of two expander bytes each, plus one byte to
+// settle RS when switching between commands and data.
+const uint8_t LCD_MAX_BYTE_COST = 5;
+
+FastLCD::FastLCD(uint8_t address, uint8_t cols, uint8_t rows)
+    : address(address), cols(cols), rows(rows), backlightBits(LCD_BACKLIGHT), lastMode(0), burstBytes(0),
+      queueHead(0), queueCount(0), cursorCol(0), cursorRow(0), dirty(false), mirror(NULL), readyAt(0) {
+    if (this->cols > MAX_COLS) {
+        this->cols = MAX_COLS;
+    }
+    if (this->rows > MAX_ROWS) {
+        this->rows = MAX_ROWS;
+    }
+    memset(frame, ' ', sizeof(frame));
+    memset(shown, ' ', sizeof(shown));
+}
+
+void FastLCD::init() {
+    Wire.begin();
+    Wire.setClock(LCD_I2C_CLOCK);
+
+    expanderWrite(backlightBits);
+
+    // The power-up wait and the reset sequence are queued like any other
+    // write, so init() returns at once and update() steps through them while
+    // the rest of the firmware starts. isIdle() turns true when done.
+    readyAt = LCD_POWER_UP_US;
+
+    // Reset into 4-bit mode: three times 0x3, then 0x2
+    enqueue(0x30, LCD_OP_NIBBLE);
+    enqueue(LCD_RESET_WAIT, LCD_OP_WAIT);
+    enqueue(0x30, LCD_OP_NIBBLE);
+    enqueue(LCD_RESET_WAIT, LCD_OP_WAIT);
+    enqueue(0x30, LCD_OP_NIBBLE);
+    enqueue(LCD_RESET_SHORT_WAIT, LCD_OP_WAIT);
+    enqueue(0x20, LCD_OP_NIBBLE);
+
+    enqueue(LCD_FUNCTION_SET, LCD_OP_COMMAND);
+    enqueue(LCD_DISPLAY_ON, LCD_OP_COMMAND);
+    enqueue(LCD_ENTRY_MODE, LCD_OP_COMMAND);
+    enqueue(LCD_CLEAR, LCD_OP_COMMAND);
+    enqueue(LCD_CLEAR_WAIT, LCD_OP_WAIT);
+    memset(shown, ' ', sizeof(shown));
+    dirty = true;
+}
+
+void FastLCD::backlight() {
+    backlightBits = LCD_BACKLIGHT;
+    expanderWrite(backlightBits);
+}
+
+void FastLCD::noBacklight() {
+    backlightBits = 0;
+    expanderWrite(backlightBits);
+}
+
+void FastLCD::clear() {
+    // Overwrite instead of sending the HD44780 clear: whatever is redrawn
+    // before the next update() replaces the old text in the same pass
+    memset(frame, ' ', sizeof(frame));
+    cursorCol = 0;
+    cursorRow = 0;
+    dirty = true;
+}
+
+void FastLCD::home() {
+    cursorCol = 0;
+    cursorRow = 0;
+}
+
+void FastLCD::setCursor(uint8_t col, uint8_t row) {
+    if (row >= rows) {
+        row = rows - 1;
+    }
+    cursorCol = col;
+    cursorRow = row;
+}
+
+size_t FastLCD::write(uint8_t value) {
+    if (cursorCol < cols) {
+        if (frame[cursorRow][cursorCol] != value) {
+            frame[cursorRow][cursorCol] = value;
+            dirty = true;
+        }
+        cursorCol++;
+    }
+    return 1;
+}
+
+size_t FastLCD::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+void FastLCD::update() {
+    if (!isReady()) {
+        return;
+    }
+    if (queueCount == 0) {
+        if (!dirty) {
+            return;
+        }
+        diffFrame();
+    }
+
+    // Send everything up to the next wait, packed into as few transactions
+    // as the Wire buffer allows
+    uint8_t wait = 0;
+    while (queueCount > 0 && wait == 0) {
+        beginBurst();
+        while (queueCount > 0 && burstBytes + LCD_MAX_BYTE_COST <= BUFFER_LENGTH) {
+            uint8_t value = queueValues[queueHead];
+            uint8_t op = queueOps[queueHead];
+            queueHead = (queueHead + 1) % QUEUE_SIZE;
+            queueCount--;
+
+            if (op == LCD_OP_WAIT) {
+                wait = value;
+                break;
+            } else if (op == LCD_OP_NIBBLE) {
+                pushNibble(value);
+            } else {
+                pushByte(value, op == LCD_OP_DATA ? LCD_RS : 0);
+            }
+        }
+        endBurst();
+    }
+
+    if (wait > 0) {
+        readyAt = micros() + (unsigned long)wait * LCD_WAIT_UNIT_US;
+    }
+}
+
+void FastLCD::flush() {
+    while (!isIdle()) {
+        update();
+    }
+}
+
+bool FastLCD::isIdle() const {
+    return queueCount == 0 && !dirty;
+}
+
+void FastLCD::diffFrame() {
+    static const uint8_t rowOffsets[] = {0x00, 0x40, 0x14, 0x54};
+
+    for (uint8_t row = 0; row < rows; ++row) {
+        uint8_t col = 0;
+        while (col < cols) {
+            if (frame[row][col] == shown[row][col]) {
+                col++;
+                continue;
+            }
+
+            // Extend the run over unchanged cells when that is no more
+            // expensive than moving the cursor again
+            uint8_t end = col + 1;
+            uint8_t last = col;
+            while (end < cols && end - last <= 2) {
+                if (frame[row][end] != shown[row][end]) {
+                    last = end;
+                }
+                end++;
+            }
+
+            enqueue(LCD_SET_DDRAM | (col + rowOffsets[row]), LCD_OP_COMMAND);
+            for (uint8_t i = col; i <= last; ++i) {
+                enqueue(frame[row][i], LCD_OP_DATA);
+                shown[row][i] = frame[row][i];
+            }
+            if (mirror != NULL) {
+                mirrorRun(row, col, last - col + 1);
+            }
+            col = last + 1;
+        }
+    }
+    dirty = false;
+}
+
+void FastLCD::setMirror(Print *out) {
+    mirror = out;
+    if (mirror == NULL) {
+        return;
+    }
+
+    // Clear the terminal, keep the LCD rows and a separator fixed above a
+    // scrolling region, then draw what the display currently shows
+    mirror->print(F("\033[2J\033[4r"));
+    for (uint8_t row = 0; row < rows; ++row) {
+        mirrorRun(row, 0, cols);
+    }
+    mirror->print(F("\033[3;1H"));
+    for (uint8_t col = 0; col < cols; ++col) {
+        mirror->write('-');
+    }
+    mirror->print(F("\033[4;1H"));
+}
+
+void FastLCD::mirrorRun(uint8_t row, uint8_t col, uint8_t length) {
+    // Save cursor, move to the cell, draw, restore cursor
+    mirror->print(F("\0337\033["));
+    mirror->print(row + 1);
+    mirror->write(';');
+    mirror->print(col + 1);
+    mirror->write('H');
+    for (uint8_t i = col; i < col + length; ++i) {
+        uint8_t c = shown[row][i];
+        if (c == 0xFF) {
+            c = '#'; // Full block
+        } else if (c < ' ' || c > '~') {
+            c = '?'; // CGRAM and ROM glyphs have no terminal equivalent
+        }
+        mirror->write(c);
+    }
+    mirror->print(F("\0338\r"));
+}
+
+void FastLCD::enqueue(uint8_t value, uint8_t op) {
+    if (queueCount == QUEUE_SIZE) {
+        flush(); // Queue full: wait for the controller rather than drop output
+    }
+    queueValues[(queueHead + queueCount) % QUEUE_SIZE] = value;
+    queueOps[(queueHead + queueCount) % QUEUE_SIZE] = op;
+    queueCount++;
+}
+
+bool FastLCD::isReady() const {
+    return (long)(micros() - readyAt) >= 0;
+}
+
+void FastLCD::beginBurst() {
+    Wire.beginTransmission(address);
+    burstBytes = 0;
+}
+
+void FastLCD::pushByte(uint8_t value, uint8_t mode) {
+    if (mode != lastMode) {
+        // Let RS settle before the first enable pulse in the new mode
+        Wire.write(mode | backlightBits);
+        burstBytes++;
+        lastMode = mode;
+    }
+    // At 400 kHz each expander byte takes ~22 us, so the next character's
+    // enable pulse lands well after the 37 us execution time of this one.
+    pushNibble((value & 0xF0) | mode);
+    pushNibble((value << 4) | mode);
+}
+
+void FastLCD::pushNibble(uint8_t bits) {
+    // Data is latched on the falling edge of EN
+    bits |= backlightBits;
+    Wire.write(bits | LCD_EN);
+    Wire.write(bits);
+    burstBytes += 2;
+}
+
+void FastLCD::endBurst() {
+    // No settle delay needed: the next START and address byte outlast the
+    // 37 us execution time of the last character.
+    Wire.endTransmission();
+}
+
+void FastLCD::expanderWrite(uint8_t bits) {
+    Wire.beginTransmission(address);
+    Wire.write(bits);
+    Wire.endTransmission();
+}
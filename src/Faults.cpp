@@ -0,0 +1,51 @@
+#include "Faults.h"
+
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+volatile uint8_t activeFault = FAULT_NONE;
+static void (*faultHook)() = NULL;
+
+#define FAULT_NAME(name) #name,
+static const char FAULT_NAMES[][16] PROGMEM = {
+    FAULTS(FAULT_NAME)
+};
+#undef FAULT_NAME
+
+void setFaultHook(void (*hook)()) {
+    faultHook = hook;
+}
+
+void latchFault(uint8_t fault) {
+    // Called from loop() and ISRs alike: test and set as one, so only the
+    // first fault is kept and the hook runs once
+    bool isFirst = false;
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        isFirst = activeFault == FAULT_NONE;
+        if (isFirst) {
+            activeFault = fault;
+        }
+    }
+#else
+    isFirst = activeFault == FAULT_NONE;
+    if (isFirst) {
+        activeFault = fault;
+    }
+#endif
+    if (isFirst && faultHook != NULL) {
+        faultHook();
+    }
+}
+
+void clearFault() {
+    activeFault = FAULT_NONE;
+}
+
+size_t printFault(Print &out, uint8_t fault) {
+    if (fault < FAULT_COUNT) {
+        return out.print((const __FlashStringHelper *)FAULT_NAMES[fault]);
+    }
+    return out.print(fault);
+}
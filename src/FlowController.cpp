@@ -0,0 +1,91 @@
+#include "FlowController.h"
+
+#include "Parameters.h"
+#include "StepEngine.h"
+
+const uint32_t MAX_TARGET_UL_PER_MIN = 1000000; // 1 l/min, keeps the products below in 32 bits
+const uint8_t GAIN_SHIFT = 8;
+
+static bool isActive = false;
+static uint32_t target = 0;
+static uint32_t output = 0;       // Commanded rate, ul/min
+static int32_t integral = 0;      // Sum of errors, ul/min
+static uint32_t lastMeasured = 0;
+
+// The step interval is ticksPerStep / rate << shift, with the shift keeping
+// ticksPerStep in 32 bits for pumps with few steps per ml
+static uint32_t ticksPerStep = 0;
+static uint8_t shift = 0;
+
+static uint32_t intervalFor(uint32_t ulPerMin) {
+    return (ticksPerStep / ulPerMin) << shift;
+}
+
+bool beginFlowControl(uint32_t targetUlPerMin, float stepsPerMl) {
+    if (targetUlPerMin == 0 || targetUlPerMin > MAX_TARGET_UL_PER_MIN || stepsPerMl <= 0) {
+        return false;
+    }
+    // Timer ticks per step at 1 ul/min: 60e3 ul/min per ml/s, once per start
+    float ticks = 60000.0f * StepEngine::TICKS_PER_SECOND / stepsPerMl;
+    shift = 0;
+    while (ticks >= 4294967295.0f) {
+        ticks /= 2;
+        shift++;
+    }
+    ticksPerStep = ticks;
+
+    target = targetUlPerMin;
+    output = targetUlPerMin; // The calibration is the feedforward
+    integral = 0;
+    lastMeasured = 0;
+    isActive = true;
+    return true;
+}
+
+void endFlowControl() {
+    isActive = false;
+}
+
+bool isFlowControlled() {
+    return isActive;
+}
+
+uint32_t updateFlowControl(uint32_t measuredUlPerMin) {
+    int32_t limit = target / 2; // Trim range either way
+    int32_t measured = measuredUlPerMin < MAX_TARGET_UL_PER_MIN ? measuredUlPerMin : MAX_TARGET_UL_PER_MIN;
+    int32_t error = (int32_t)target - measured;
+    int32_t kp = paramGet(P_PID_P);
+    int32_t ki = paramGet(P_PID_I);
+    int32_t kd = paramGet(P_PID_D);
+
+    // pid_i may have changed since the last update
+    int32_t maxIntegral = ki > 0 ? (limit << GAIN_SHIFT) / ki : 0;
+    integral = constrain(integral, -maxIntegral, maxIntegral);
+
+    // Derivative on the measurement, so a new target does not kick it
+    int32_t proportional = (kp * error) >> GAIN_SHIFT;
+    int32_t derivative = (kd * (measured - (int32_t)lastMeasured)) >> GAIN_SHIFT;
+    lastMeasured = measured;
+
+    int32_t correction = proportional + ((ki * integral) >> GAIN_SHIFT) - derivative;
+    bool isSaturated = (correction >= limit && error > 0) || (correction <= -limit && error < 0);
+    if (measured > 0 && !isSaturated) {
+        integral = constrain(integral + error, -maxIntegral, maxIntegral);
+        correction = proportional + ((ki * integral) >> GAIN_SHIFT) - derivative;
+    }
+
+    output = target + constrain(correction, -limit, limit);
+    return intervalFor(output);
+}
+
+uint32_t flowControlInterval() {
+    return intervalFor(output);
+}
+
+uint32_t flowControlTarget() {
+    return target;
+}
+
+uint32_t flowControlOutput() {
+    return output;
+}
@@ -0,0 +1,124 @@
+#include "FlowSensor.h"
+
+#include "Parameters.h"
+#include "Timer1.h"
+
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+const uint32_t FLOW_TIMEOUT_US = 2000000;
+const uint8_t FLOW_PERIOD_SHIFT = 2; // Smoothing, new periods weigh 1/4
+
+static volatile uint32_t pulseCount = 0;
+static volatile uint32_t lastCapture = 0;
+static volatile uint32_t period = 0; // Smoothed, ticks; 0 until two pulses
+static volatile bool hasCapture = false;
+
+static void capture(uint32_t ticks) {
+    if (hasCapture) {
+        uint32_t elapsed = ticks - lastCapture;
+        if (elapsed > FLOW_TIMEOUT_US * TIMER1_TICKS_PER_US) {
+            period = 0; // Flow restarted, the gap is not a period
+        } else if (period == 0) {
+            period = elapsed;
+        } else {
+            period += ((int32_t)(elapsed - period)) >> FLOW_PERIOD_SHIFT;
+        }
+    }
+    lastCapture = ticks;
+    hasCapture = true;
+    pulseCount++;
+}
+
+#ifdef __AVR__
+
+static volatile uint16_t overflows = 0;
+
+void beginFlowSensor() {
+    pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP); // Open-collector output
+    beginTimer1();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIFR1 = _BV(ICF1) | _BV(TOV1);
+        TIMSK1 |= _BV(ICIE1) | _BV(TOIE1);
+    }
+}
+
+ISR(TIMER1_OVF_vect) {
+    overflows++;
+}
+
+ISR(TIMER1_CAPT_vect) {
+    uint16_t low = ICR1;
+    uint16_t high = overflows;
+    // The counter wrapped just before the edge, but the overflow interrupt
+    // has not run yet
+    if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+        high++;
+    }
+    capture((uint32_t)high << 16 | low);
+}
+
+static uint32_t ticksNow() {
+    uint32_t ticks;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint16_t low = TCNT1;
+        uint16_t high = overflows;
+        if ((TIFR1 & _BV(TOV1)) && low < 0x8000) {
+            high++;
+        }
+        ticks = (uint32_t)high << 16 | low;
+    }
+    return ticks;
+}
+
+#else
+
+// The virtual device calls this for each simulated meter pulse
+void flowSensorPulse() {
+    capture(micros() * TIMER1_TICKS_PER_US);
+}
+
+void beginFlowSensor() {
+}
+
+static uint32_t ticksNow() {
+    return micros() * TIMER1_TICKS_PER_US;
+}
+
+#endif
+
+uint32_t flowPulseCount() {
+    uint32_t count;
+    noInterrupts();
+    count = pulseCount;
+    interrupts();
+    return count;
+}
+
+uint32_t flowPeriodUs() {
+    uint32_t last;
+    uint32_t ticks;
+    noInterrupts();
+    last = lastCapture;
+    ticks = period;
+    interrupts();
+
+    if (ticks == 0 || ticksNow() - last > FLOW_TIMEOUT_US * TIMER1_TICKS_PER_US) {
+        return 0;
+    }
+    return ticks / TIMER1_TICKS_PER_US;
+}
+
+uint32_t flowRateUlPerMin() {
+    uint32_t periodUs = flowPeriodUs();
+    if (periodUs == 0) {
+        return 0;
+    }
+    // 60e6 us/min * 1e6 ul/l / (pulses/l * us/pulse)
+    return 6e13f / ((float)paramGet(P_FLOW_K) * periodUs) + 0.5f;
+}
+
+float flowVolumeMl(uint32_t pulses) {
+    return pulses * 1000.0f / paramGet(P_FLOW_K);
+}
@@ -0,0 +1,142 @@
+#include "FluidProfiles.h"
+
+#include "EepromLayout.h"
+#include "EepromQueue.h"
+#include "Log.h"
+
+#ifdef __AVR__ // Padded on the host, where the writes go straight through
+static_assert(sizeof(FluidProfile) <= EepromQueue::QUEUE_SIZE, "A profile save would wait for the EEPROM");
+#endif
+
+const uint16_t DEFAULT_CURVE_SPEEDS[PROFILE_CURVE_POINTS] = {400, 2000, 6000};
+const uint16_t DEFAULT_MAX_SPEED = 6000;
+const uint16_t DEFAULT_ACCELERATION = 800;
+
+FluidProfile activeProfile;
+ResonanceBand activeBands[PROFILE_BANDS];
+uint8_t activeProfileSlot = 0;
+
+static float defaultStepsPerMl = 0;
+
+static int profileAddress(uint8_t slot) {
+    return PROFILES_ADDR + slot * sizeof(FluidProfile);
+}
+
+static int bandsAddress(uint8_t slot) {
+    return BANDS_ADDR + slot * PROFILE_BANDS * sizeof(ResonanceBand);
+}
+
+void loadProfiles(float legacyStepsPerMl) {
+    defaultStepsPerMl = legacyStepsPerMl;
+
+    uint8_t slot = eepromQueue.read(ACTIVE_PROFILE_ADDR);
+    if (slot >= PROFILE_COUNT) {
+        slot = 0; // Erased EEPROM
+    }
+    activeProfileSlot = slot;
+    readProfile(slot, activeProfile);
+    readBands(slot, activeBands);
+}
+
+bool selectProfile(uint8_t slot) {
+    if (slot >= PROFILE_COUNT) {
+        return false;
+    }
+    if (slot != activeProfileSlot) {
+        activeProfileSlot = slot;
+        readProfile(slot, activeProfile);
+        readBands(slot, activeBands);
+        eepromQueue.write(ACTIVE_PROFILE_ADDR, slot);
+        LOG(PROFILE_SELECT, slot);
+    }
+    return true;
+}
+
+void readProfile(uint8_t slot, FluidProfile &profile) {
+    eepromQueue.get(profileAddress(slot), profile);
+
+    if ((uint8_t)profile.name[0] == 0xFF) {
+        // Never written: start from the pre-profile calibration
+        memset(&profile, 0, sizeof(profile));
+        strcpy(profile.name, "Fluid ");
+        profile.name[6] = '1' + slot;
+        for (uint8_t i = 0; i < PROFILE_CURVE_POINTS; ++i) {
+            profile.curveSpeed[i] = DEFAULT_CURVE_SPEEDS[i];
+            profile.curveStepsPerMl[i] = defaultStepsPerMl;
+        }
+        profile.maxSpeed = DEFAULT_MAX_SPEED;
+        profile.acceleration = DEFAULT_ACCELERATION;
+    }
+    profile.name[PROFILE_NAME_LENGTH - 1] = '\0';
+}
+
+void writeProfile(uint8_t slot, const FluidProfile &profile) {
+    eepromQueue.put(profileAddress(slot), profile);
+    if (slot == activeProfileSlot && &profile != &activeProfile) {
+        activeProfile = profile;
+    }
+}
+
+void saveActiveProfile() {
+    writeProfile(activeProfileSlot, activeProfile);
+}
+
+void readBands(uint8_t slot, ResonanceBand *bands) {
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        // Erased EEPROM reads 0xFFFF for both, which is no band
+        eepromQueue.get(bandsAddress(slot) + i * sizeof(ResonanceBand), bands[i]);
+    }
+}
+
+void writeBands(uint8_t slot, const ResonanceBand *bands) {
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        eepromQueue.put(bandsAddress(slot) + i * sizeof(ResonanceBand), bands[i]);
+        if (slot == activeProfileSlot) {
+            activeBands[i] = bands[i];
+        }
+    }
+}
+
+float stepsPerMl(const FluidProfile &profile, uint16_t speed) {
+    const uint8_t last = PROFILE_CURVE_POINTS - 1;
+
+    if (speed <= profile.curveSpeed[0]) {
+        return profile.curveStepsPerMl[0];
+    }
+    for (uint8_t i = 0; i < last; ++i) {
+        uint16_t from = profile.curveSpeed[i];
+        uint16_t to = profile.curveSpeed[i + 1];
+        if (speed <= to) {
+            float t = (float)(speed - from) / (to - from);
+            return profile.curveStepsPerMl[i] + t * (profile.curveStepsPerMl[i + 1] - profile.curveStepsPerMl[i]);
+        }
+    }
+    return profile.curveStepsPerMl[last];
+}
+
+void setCalibrationPoint(FluidProfile &profile, uint16_t speed, float value) {
+    bool isCalibrated = false;
+    for (uint8_t i = 0; i < PROFILE_CURVE_POINTS; ++i) {
+        if (profile.curveStepsPerMl[i] != 0) {
+            isCalibrated = true;
+        }
+    }
+
+    if (!isCalibrated) {
+        // First calibration of this fluid: assume a flat curve
+        for (uint8_t i = 0; i < PROFILE_CURVE_POINTS; ++i) {
+            profile.curveStepsPerMl[i] = value;
+        }
+        return;
+    }
+
+    // Replace the point closest to the calibration speed
+    uint8_t nearest = 0;
+    for (uint8_t i = 1; i < PROFILE_CURVE_POINTS; ++i) {
+        if (abs((long)profile.curveSpeed[i] - speed) < abs((long)profile.curveSpeed[nearest] - speed)) {
+            nearest = i;
+        }
+    }
+    profile.curveSpeed[nearest] = speed;
+    profile.curveStepsPerMl[nearest] = value;
+}
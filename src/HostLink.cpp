@@ -0,0 +1,84 @@
+#include "HostLink.h"
+
+HostLink::HostLink(Stream &stream, CommandHandler handler)
+    : stream(stream), commandLine(stream), handler(handler), nextExpected(0), replySequence(-1) {
+    memset(isBuffered, 0, sizeof(isBuffered));
+}
+
+void HostLink::poll() {
+    char *line = commandLine.poll();
+    if (line == NULL) {
+        return;
+    }
+
+    if (line[0] == '#') {
+        char *command;
+        long sequence = strtol(line + 1, &command, 10);
+        if (*command == ' ') {
+            command++;
+        }
+        if (commandLine.isTruncated()) {
+            *command = '\0'; // Still answered, so the host does not resend it
+        }
+        receiveFrame((uint8_t)sequence, command);
+    } else if (commandLine.isTruncated()) {
+        line[0] = '\0';
+        execute(-1, line);
+    } else if (strncmp(line, "SYNC ", 5) == 0) {
+        nextExpected = (uint8_t)atoi(line + 5);
+        memset(isBuffered, 0, sizeof(isBuffered));
+        sendAck();
+    } else {
+        execute(-1, line);
+    }
+}
+
+void HostLink::beginReplyLine() {
+    if (replySequence >= 0) {
+        stream.print('#');
+        stream.print(replySequence);
+        stream.print(' ');
+    }
+}
+
+void HostLink::receiveFrame(uint8_t sequence, char *command) {
+    uint8_t ahead = sequence - nextExpected; // Modulo 256
+
+    if (ahead == 0) {
+        execute(sequence, command);
+        nextExpected++;
+
+        // Frames that were waiting for this one
+        while (isBuffered[nextExpected % WINDOW]) {
+            uint8_t slot = nextExpected % WINDOW;
+            isBuffered[slot] = false;
+            execute(nextExpected, frames[slot]);
+            nextExpected++;
+        }
+    } else if (ahead < WINDOW) {
+        // Out of order: hold it and tell the host what is missing
+        uint8_t slot = sequence % WINDOW;
+        if (!isBuffered[slot]) {
+            strcpy(frames[slot], command);
+            isBuffered[slot] = true;
+        }
+        sendAck();
+    } else {
+        // Already executed (a resend whose reply was lost) or outside the
+        // window: never execute twice, just report progress
+        sendAck();
+    }
+}
+
+void HostLink::execute(int sequence, char *command) {
+    replySequence = sequence;
+    bool isOk = command[0] != '\0' && handler(command);
+    beginReplyLine();
+    stream.println(isOk ? F("OK") : F("ERR"));
+    replySequence = -1;
+}
+
+void HostLink::sendAck() {
+    stream.print('@');
+    stream.println(nextExpected);
+}
@@ -0,0 +1,107 @@
+#include "LoadCell.h"
+
+#include "Parameters.h"
+
+static int32_t latest = 0;
+static int32_t offset = 0;
+static unsigned long sampleTime = 0;
+static bool hasSample = false;
+
+static int32_t tareSum = 0;
+static uint8_t tareCount = 0;
+static bool isTared = false;
+
+static void addSample(int32_t raw) {
+    latest = raw;
+    sampleTime = millis();
+    hasSample = true;
+
+    if (!isTared) {
+        tareSum += raw;
+        if (++tareCount == LOAD_CELL_TARE_SAMPLES) {
+            offset = tareSum / LOAD_CELL_TARE_SAMPLES;
+            isTared = true;
+        }
+    }
+}
+
+#ifdef __AVR__
+
+void beginLoadCell() {
+    pinMode(LOAD_CELL_DOUT_PIN, INPUT);
+    pinMode(LOAD_CELL_SCK_PIN, OUTPUT);
+    digitalWrite(LOAD_CELL_SCK_PIN, LOW); // High for over 60 us powers it down
+}
+
+static uint8_t clockBit() {
+    // An interrupt inside the high phase could power the HX711 down
+    noInterrupts();
+    digitalWrite(LOAD_CELL_SCK_PIN, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(LOAD_CELL_SCK_PIN, LOW);
+    interrupts();
+    return digitalRead(LOAD_CELL_DOUT_PIN);
+}
+
+bool loadCellUpdate() {
+    if (digitalRead(LOAD_CELL_DOUT_PIN) == HIGH) {
+        return false; // Still converting
+    }
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < 24; ++i) {
+        value = value << 1 | clockBit();
+    }
+    clockBit(); // 25th pulse: channel A, gain 128 for the next sample
+    addSample((int32_t)(value << 8) >> 8); // 24-bit two's complement
+    return true;
+}
+
+#else
+
+static bool isSamplePending = false;
+static int32_t pendingSample = 0;
+
+// The virtual device calls this for each simulated conversion
+void loadCellSample(int32_t raw) {
+    pendingSample = raw;
+    isSamplePending = true;
+}
+
+void beginLoadCell() {
+}
+
+bool loadCellUpdate() {
+    if (!isSamplePending) {
+        return false;
+    }
+    isSamplePending = false;
+    addSample(pendingSample);
+    return true;
+}
+
+#endif
+
+void tareLoadCell() {
+    tareSum = 0;
+    tareCount = 0;
+    isTared = false;
+}
+
+bool isLoadCellTared() {
+    return isTared;
+}
+
+bool isLoadCellResponding() {
+    return hasSample && millis() - sampleTime <= LOAD_CELL_TIMEOUT_MS;
+}
+
+int32_t loadCellRaw() {
+    return latest;
+}
+
+int32_t loadCellMg() {
+    // Split so the product stays in 32 bits for the whole 24-bit range
+    int32_t counts = latest - offset;
+    int32_t perGram = paramGet(P_SCALE_CPG);
+    return counts / perGram * 1000 + counts % perGram * 1000 / perGram;
+}
@@ -0,0 +1,94 @@
+#include "Log.h"
+
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+// Records are stored as [size][id][arguments], size counting id and
+// arguments. head and tail run freely and are masked on access, so the
+// buffer can be completely full.
+static uint8_t buffer[LOG_BUFFER_SIZE];
+static volatile uint8_t head = 0; // Written under the lock
+static volatile uint8_t tail = 0; // Written by logFlush() only
+static volatile uint16_t dropped = 0;
+
+static const uint8_t LOG_MASK = LOG_BUFFER_SIZE - 1;
+
+static bool logCopy(const uint8_t *record, uint8_t size) {
+    uint8_t used = head - tail;
+    if (used + size + 1 > LOG_BUFFER_SIZE) {
+        return false;
+    }
+    uint8_t index = head;
+    buffer[index++ & LOG_MASK] = size;
+    for (uint8_t i = 0; i < size; ++i) {
+        buffer[index++ & LOG_MASK] = record[i];
+    }
+    head = index; // Publish the whole record at once
+    return true;
+}
+
+static bool logCopyOrCount(const uint8_t *record, uint8_t size) {
+    if (logCopy(record, size)) {
+        return true;
+    }
+    if (dropped < 0xFFFF) {
+        dropped++;
+    }
+    return false;
+}
+
+static void logCopyDropped() {
+    // Written directly, so failing to report drops is not another drop
+    uint8_t record[1 + sizeof(uint16_t)];
+    uint16_t count = dropped;
+    record[0] = LOG_DROPPED;
+    memcpy(record + 1, &count, sizeof(count));
+    if (logCopy(record, sizeof(record))) {
+        dropped = 0;
+    }
+}
+
+bool logWrite(const uint8_t *record, uint8_t size) {
+    bool isWritten;
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        isWritten = logCopyOrCount(record, size);
+    }
+#else
+    isWritten = logCopyOrCount(record, size);
+#endif
+    return isWritten;
+}
+
+static void printHex(Print &out, uint8_t value) {
+    static const char DIGITS[] = "0123456789ABCDEF";
+    out.write(DIGITS[value >> 4]);
+    out.write(DIGITS[value & 0x0F]);
+}
+
+void logFlush(Print &out) {
+    while (tail != head) {
+        uint8_t index = tail;
+        uint8_t size = buffer[index++ & LOG_MASK];
+        if (out.availableForWrite() < 2 * size + 3) {
+            return; // Try again on the next loop instead of blocking
+        }
+        out.write('$');
+        for (uint8_t i = 0; i < size; ++i) {
+            printHex(out, buffer[index++ & LOG_MASK]);
+        }
+        out.println();
+        tail = index;
+    }
+
+    if (dropped > 0) {
+#ifdef __AVR__
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            logCopyDropped();
+        }
+#else
+        logCopyDropped();
+#endif
+    }
+}
@@ -0,0 +1,68 @@
+#include "MotionSupervisor.h"
+
+#include "Faults.h"
+#include "Parameters.h"
+
+// Covers loop() latency and the first step of a ramp from standstill
+const unsigned long MOTION_SLACK_MS = 250;
+
+static bool isSupervising[SUPERVISED_CHANNELS];
+static unsigned long moveStartTime[SUPERVISED_CHANNELS];
+static unsigned long moveAllowedTime[SUPERVISED_CHANNELS];
+static unsigned long lastProgressTime[SUPERVISED_CHANNELS];
+static long lastPosition[SUPERVISED_CHANNELS];
+
+float moveSeconds(long steps, float speed, float acceleration) {
+    if (speed <= 0) {
+        return 0;
+    }
+    if (acceleration <= 0) {
+        return steps / speed; // Constant speed, as in calibration
+    }
+    // Trapezoid if the move reaches full speed, otherwise a triangle
+    float rampSteps = speed * speed / (2 * acceleration);
+    if (steps >= 2 * rampSteps) {
+        return steps / speed + speed / acceleration;
+    }
+    return 2 * sqrt(steps / acceleration);
+}
+
+void superviseMove(uint8_t channel, long steps, float speed, float acceleration) {
+    float seconds = moveSeconds(labs(steps), speed, acceleration);
+    if (seconds <= 0) {
+        isSupervising[channel] = false;
+        return;
+    }
+    moveAllowedTime[channel] = seconds * (100 + paramGet(P_MOVE_MARGIN_PCT)) * 10 + MOTION_SLACK_MS;
+    moveStartTime[channel] = millis();
+    lastProgressTime[channel] = moveStartTime[channel];
+    isSupervising[channel] = true;
+}
+
+void endSupervision(uint8_t channel) {
+    isSupervising[channel] = false;
+}
+
+uint8_t checkMotion(uint8_t channel, long position, long distanceToGo) {
+    if (!isSupervising[channel]) {
+        return FAULT_NONE;
+    }
+    if (distanceToGo == 0) {
+        isSupervising[channel] = false;
+        return FAULT_NONE;
+    }
+
+    unsigned long now = millis();
+    if (position != lastPosition[channel]) {
+        lastPosition[channel] = position;
+        lastProgressTime[channel] = now;
+    } else if (now - lastProgressTime[channel] > (unsigned long)paramGet(P_STALL_TIME_MS)) {
+        isSupervising[channel] = false;
+        return FAULT_STALL;
+    }
+    if (now - moveStartTime[channel] > moveAllowedTime[channel]) {
+        isSupervising[channel] = false;
+        return FAULT_MOTION_TIMEOUT;
+    }
+    return FAULT_NONE;
+}
@@ -0,0 +1,120 @@
+#include "OcclusionMonitor.h"
+
+#include "Faults.h"
+#include "Log.h"
+#include "Parameters.h"
+
+// Half stepping: 8 steps are one electrical cycle of the motor, so every
+// sample sees the same winding currents
+const uint8_t OCCLUSION_STEP_INTERVAL = 8;
+const uint8_t OCCLUSION_WARMUP = 16;
+const uint8_t BASELINE_SHIFT = 4; // Baseline in 1/16 ADC counts, and the weight of a new sample
+
+static volatile bool isMonitoring = false;
+static volatile bool isSamplePending = false;
+static uint8_t stepCount = 0;
+static uint8_t sampleCount = 0;
+static uint8_t highCount = 0;
+static uint16_t baseline = 0;
+
+static void processSample(uint16_t sample) {
+    uint16_t scaled = sample << BASELINE_SHIFT;
+    if (sampleCount < OCCLUSION_WARMUP) {
+        // Running average of what has been seen so far
+        sampleCount++;
+        baseline += ((int16_t)scaled - (int16_t)baseline) / sampleCount;
+        return;
+    }
+
+    if ((uint32_t)scaled * 100 > (uint32_t)baseline * (100 + paramGet(P_OCCL_RISE_PCT))) {
+        if (++highCount >= paramGet(P_OCCL_SAMPLES)) {
+            isMonitoring = false;
+            LOG(OCCLUSION, sample, baseline >> BASELINE_SHIFT);
+            latchFault(FAULT_OCCLUSION);
+        }
+        return;
+    }
+    highCount = 0;
+    baseline += ((int16_t)scaled - (int16_t)baseline) >> BASELINE_SHIFT;
+}
+
+#ifdef __AVR__
+
+// Timer0 runs at 4 us per tick for millis()
+const uint8_t TIMER0_TICK_US = 4;
+
+void beginOcclusionMonitor() {
+    stepCount = 0;
+    sampleCount = 0;
+    highCount = 0;
+    baseline = 0;
+    isSamplePending = false;
+
+    // In the Fast PWM mode Arduino sets up, OCR0A only takes a new value at
+    // the next overflow, up to 1 ms late. Normal mode writes it at once and
+    // still overflows every 256 ticks, so millis() keeps its rate. Timer0
+    // drives no PWM pin here.
+    TCCR0A &= ~(_BV(WGM01) | _BV(WGM00));
+
+    // Conversions start on Timer0 compare match A, 125 kHz ADC clock
+    ADCSRB = _BV(ADTS1) | _BV(ADTS0);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIF) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+    isMonitoring = true;
+}
+
+void endOcclusionMonitor() {
+    isMonitoring = false;
+    // Back to single conversions for analogRead()
+    ADCSRA = _BV(ADEN) | _BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+    ADCSRB = 0;
+    TCCR0A |= _BV(WGM01) | _BV(WGM00);
+}
+
+void occlusionStep() {
+    if (!isMonitoring || isSamplePending || ++stepCount < OCCLUSION_STEP_INTERVAL) {
+        return;
+    }
+    stepCount = 0;
+
+    ADMUX = _BV(REFS0) | (CURRENT_SENSE_PIN - A0);
+    // The trigger is the rising edge of OCF0A. Nothing else clears it, so
+    // each arm starts exactly one conversion.
+    OCR0A = TCNT0 + paramGet(P_OCCL_PHASE_US) / TIMER0_TICK_US;
+    TIFR0 = _BV(OCF0A);
+    isSamplePending = true;
+}
+
+ISR(ADC_vect) {
+    if (!isSamplePending) {
+        return; // An analogRead() conversion
+    }
+    isSamplePending = false;
+    if (isMonitoring) {
+        processSample(ADC);
+    }
+}
+
+#else
+
+// The virtual device reads the sense input at the step itself
+void beginOcclusionMonitor() {
+    stepCount = 0;
+    sampleCount = 0;
+    highCount = 0;
+    baseline = 0;
+    isMonitoring = true;
+}
+
+void endOcclusionMonitor() {
+    isMonitoring = false;
+}
+
+void occlusionStep() {
+    if (!isMonitoring || ++stepCount < OCCLUSION_STEP_INTERVAL) {
+        return;
+    }
+    stepCount = 0;
+    processSample(analogRead(CURRENT_SENSE_PIN));
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "Parameters.h"
+
+#include "EepromLayout.h"
+#include "EepromQueue.h"
+#include "Log.h"
+
+struct ParamInfo {
+    uint16_t id;
+    uint8_t type;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t initial;
+    char name[PARAM_NAME_LENGTH];
+};
+
+#define PARAM_INFO(index, name, type, minimum, maximum, initial) {paramHash(name), type, minimum, maximum, initial, name},
+static const ParamInfo PARAM_INFO_TABLE[PARAM_COUNT] PROGMEM = {
+    PARAMETERS(PARAM_INFO)
+};
+#undef PARAM_INFO
+
+#define PARAM_ID(index, name, type, minimum, maximum, initial) paramHash(name),
+constexpr uint16_t PARAM_IDS[PARAM_COUNT] = {
+    PARAMETERS(PARAM_ID)
+};
+#undef PARAM_ID
+
+// Compile-time check that the hash is perfect for the current names
+
+constexpr bool collidesWithEarlier(uint8_t index, uint8_t other = 0) {
+    return other >= index ? false
+                          : (paramSlot(PARAM_IDS[other]) == paramSlot(PARAM_IDS[index]) || collidesWithEarlier(index, other + 1));
+}
+
+constexpr bool isPerfectHash(uint8_t index = 0) {
+    return index >= PARAM_COUNT ? true : !collidesWithEarlier(index) && isPerfectHash(index + 1);
+}
+
+static_assert(isPerfectHash(), "Parameter slots collide, change PARAM_HASH_SEED");
+static_assert(PARAM_TABLE_SIZE == 1 << PARAM_SLOT_BITS, "Slots are the top PARAM_SLOT_BITS of the hash");
+static_assert(PARAM_COUNT <= PARAM_RECORD_COUNT, "No EEPROM record left for a parameter");
+
+// Slot to parameter index, also computed at compile time
+
+constexpr uint8_t indexForSlot(uint8_t slot, uint8_t index = 0) {
+    return index >= PARAM_COUNT ? PARAM_NOT_FOUND
+                                : (paramSlot(PARAM_IDS[index]) == slot ? index : indexForSlot(slot, index + 1));
+}
+
+#define PARAM_SLOTS_4(slot) \
+    indexForSlot(slot), indexForSlot(slot + 1), indexForSlot(slot + 2), indexForSlot(slot + 3)
+#define PARAM_SLOTS_16(slot) \
+    PARAM_SLOTS_4(slot), PARAM_SLOTS_4(slot + 4), PARAM_SLOTS_4(slot + 8), PARAM_SLOTS_4(slot + 12)
+static_assert(PARAM_TABLE_SIZE == 64, "PARAM_SLOTS lists 64 slots");
+static const uint8_t PARAM_SLOTS[PARAM_TABLE_SIZE] PROGMEM = {
+    PARAM_SLOTS_16(0), PARAM_SLOTS_16(16), PARAM_SLOTS_16(32), PARAM_SLOTS_16(48)
+};
+#undef PARAM_SLOTS_16
+#undef PARAM_SLOTS_4
+
+// EEPROM record: the ID it belongs to, then the value. Found by ID, so
+// neither the hash seed nor the order of PARAMETERS moves a saved value.
+// Records of IDs no current parameter has are free.
+const uint8_t PARAM_RECORD_SIZE = sizeof(uint16_t) + sizeof(int32_t);
+
+const char *const PARAM_TYPE_NAMES[] = {"bool", "u8", "u16", "i32"};
+
+int32_t paramValues[PARAM_COUNT];
+
+static void readInfo(uint8_t index, ParamInfo &info) {
+    memcpy_P(&info, &PARAM_INFO_TABLE[index], sizeof(info));
+}
+
+static int recordAddress(uint8_t record) {
+    return PARAMS_ADDR + record * PARAM_RECORD_SIZE;
+}
+
+// The record holding id, or else the first free one
+static uint8_t findRecord(uint16_t id) {
+    uint8_t free = PARAM_NOT_FOUND;
+    for (uint8_t record = 0; record < PARAM_RECORD_COUNT; ++record) {
+        uint16_t storedId;
+        eepromQueue.get(recordAddress(record), storedId);
+        if (storedId == id) {
+            return record;
+        }
+        if (free == PARAM_NOT_FOUND && paramFind(storedId) == PARAM_NOT_FOUND) {
+            free = record;
+        }
+    }
+    return free;
+}
+
+void loadParams() {
+    ParamInfo info;
+    for (uint8_t index = 0; index < PARAM_COUNT; ++index) {
+        readInfo(index, info);
+        paramValues[index] = info.initial;
+    }
+
+    for (uint8_t record = 0; record < PARAM_RECORD_COUNT; ++record) {
+        uint16_t storedId;
+        int32_t value;
+        eepromQueue.get(recordAddress(record), storedId);
+        eepromQueue.get(recordAddress(record) + sizeof(uint16_t), value);
+        uint8_t index = paramFind(storedId);
+        if (index == PARAM_NOT_FOUND) {
+            continue; // Never written, or a parameter that is gone
+        }
+        readInfo(index, info);
+        if (value >= info.minimum && value <= info.maximum) {
+            paramValues[index] = value;
+        }
+    }
+}
+
+bool paramSet(uint8_t index, int32_t value) {
+    if (index >= PARAM_COUNT) {
+        return false;
+    }
+    ParamInfo info;
+    readInfo(index, info);
+    if (value < info.minimum || value > info.maximum) {
+        return false;
+    }
+
+    noInterrupts(); // Button and motion ISRs read these
+    paramValues[index] = value;
+    interrupts();
+
+    uint8_t record = findRecord(info.id);
+    eepromQueue.put(recordAddress(record), info.id);
+    eepromQueue.put(recordAddress(record) + sizeof(uint16_t), value);
+    LOG(PARAM_SET, info.id, value);
+    return true;
+}
+
+uint8_t paramFind(uint16_t id) {
+    uint8_t index = pgm_read_byte(&PARAM_SLOTS[paramSlot(id)]);
+    if (index == PARAM_NOT_FOUND || pgm_read_word(&PARAM_INFO_TABLE[index].id) != id) {
+        return PARAM_NOT_FOUND;
+    }
+    return index;
+}
+
+uint8_t paramFind(const char *name) {
+    uint8_t index = paramFind(paramHash(name));
+    if (index == PARAM_NOT_FOUND) {
+        return PARAM_NOT_FOUND;
+    }
+
+    // An unknown name can still hash to a known ID
+    ParamInfo info;
+    readInfo(index, info);
+    return strcmp(info.name, name) == 0 ? index : PARAM_NOT_FOUND;
+}
+
+void printParam(Print &out, uint8_t index) {
+    ParamInfo info;
+    readInfo(index, info);
+
+    out.print(info.name);
+    out.print(' ');
+    out.print(PARAM_TYPE_NAMES[info.type]);
+    out.print(' ');
+    out.print(paramValues[index]);
+    out.print(' ');
+    out.print(info.minimum);
+    out.print(' ');
+    out.print(info.maximum);
+    out.print(' ');
+    out.print(info.initial);
+    out.print(F(" 0x"));
+    out.println(info.id, HEX);
+}
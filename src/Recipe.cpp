@@ -0,0 +1,93 @@
+#include "Recipe.h"
+
+static RecipeDose doses[RECIPE_MAX_DOSES];
+static uint8_t doseCount = 0;
+static uint8_t started = 0;  // Bit per dose
+static uint8_t finished = 0;
+static uint32_t ranks[RECIPE_MAX_DOSES]; // ms from the start of a dose to the end of its longest chain
+
+void clearRecipe() {
+    doseCount = 0;
+    started = 0;
+    finished = 0;
+}
+
+bool addDose(uint8_t pump, float volume, uint8_t after) {
+    // Only earlier doses can be waited for, so the graph has no cycles
+    if (doseCount == RECIPE_MAX_DOSES || pump >= RECIPE_PUMPS || after >> doseCount != 0) {
+        return false;
+    }
+    doses[doseCount].pump = pump;
+    doses[doseCount].volume = volume;
+    doses[doseCount].after = after;
+    doseCount++;
+    return true;
+}
+
+uint8_t recipeDoseCount() {
+    return doseCount;
+}
+
+const RecipeDose &recipeDose(uint8_t dose) {
+    return doses[dose];
+}
+
+void beginRecipe(const uint32_t *durations) {
+    started = 0;
+    finished = 0;
+    // Doses only wait for earlier ones, so each rank is known before the
+    // doses it waits for are visited
+    for (int8_t i = doseCount - 1; i >= 0; --i) {
+        uint32_t longest = 0;
+        for (uint8_t j = i + 1; j < doseCount; ++j) {
+            if ((doses[j].after & (1 << i)) && ranks[j] > longest) {
+                longest = ranks[j];
+            }
+        }
+        ranks[i] = durations[i] + longest;
+    }
+}
+
+int8_t nextDose(uint8_t pump) {
+    int8_t best = -1;
+    for (uint8_t i = 0; i < doseCount; ++i) {
+        if ((started & (1 << i)) || doses[i].pump != pump || (doses[i].after & ~finished) != 0) {
+            continue;
+        }
+        if (best < 0 || ranks[i] > ranks[best]) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        started |= 1 << best;
+    }
+    return best;
+}
+
+void finishDose(uint8_t dose) {
+    finished |= 1 << dose;
+}
+
+bool isRecipeDone() {
+    return finished == (uint8_t)((1 << doseCount) - 1);
+}
+
+uint8_t recipeDosesDone() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < doseCount; ++i) {
+        if (finished & (1 << i)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32_t recipeCriticalPath() {
+    uint32_t longest = 0;
+    for (uint8_t i = 0; i < doseCount; ++i) {
+        if (ranks[i] > longest) {
+            longest = ranks[i];
+        }
+    }
+    return longest;
+}
@@ -0,0 +1,126 @@
+#include "StateTrace.h"
+
+#include "EepromLayout.h"
+#include "EepromQueue.h"
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#endif
+
+static const uint8_t TRACE_MASK = TRACE_SIZE - 1;
+
+static TraceEntry entries[TRACE_SIZE];
+static volatile uint8_t head = 0;  // Next entry to write
+static volatile uint8_t count = 0; // Valid entries, up to TRACE_SIZE
+
+#define TRACE_CAUSE_NAME(name) #name,
+static const char CAUSE_NAMES[][18] PROGMEM = {
+    TRACE_CAUSES(TRACE_CAUSE_NAME)
+};
+#undef TRACE_CAUSE_NAME
+
+static void record(uint8_t from, uint8_t to, uint8_t cause) {
+    TraceEntry &entry = entries[head];
+    entry.time = millis();
+    entry.from = from;
+    entry.to = to;
+    entry.cause = cause;
+    head = (head + 1) & TRACE_MASK;
+    if (count < TRACE_SIZE) {
+        count++;
+    }
+}
+
+void traceState(uint8_t from, uint8_t to, uint8_t cause) {
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        record(from, to, cause);
+    }
+#else
+    record(from, to, cause);
+#endif
+}
+
+uint8_t traceCount() {
+    return count;
+}
+
+void readTrace(uint8_t index, TraceEntry &entry) {
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        entry = entries[(head - count + index) & TRACE_MASK];
+    }
+#else
+    entry = entries[(head - count + index) & TRACE_MASK];
+#endif
+}
+
+uint8_t savedTraceCount() {
+    uint8_t saved = eepromQueue.read(TRACE_ADDR);
+    return saved <= TRACE_SAVED_SIZE ? saved : 0; // 0xFF: never saved
+}
+
+void readSavedTrace(uint8_t index, TraceEntry &entry) {
+    eepromQueue.get(TRACE_ADDR + 1 + index * sizeof(TraceEntry), entry);
+}
+
+void printTraceCause(Print &out, uint8_t cause) {
+    if (cause < CAUSE_COUNT) {
+        out.print((const __FlashStringHelper *)CAUSE_NAMES[cause]);
+    } else {
+        out.print(cause);
+    }
+}
+
+#ifdef __AVR__
+
+// A watchdog reset leaves the watchdog running at its shortest timeout, so
+// turn it off before the C runtime and setup() get going
+void watchdogOff() __attribute__((naked, used, section(".init3")));
+void watchdogOff() {
+    MCUSR = 0;
+    wdt_disable();
+}
+
+static void saveTrace() {
+    // Interrupts are off, so write directly instead of through eepromQueue.
+    // Eight entries take about 200 ms, well within the second timeout.
+    uint8_t saved = count < TRACE_SAVED_SIZE ? count : TRACE_SAVED_SIZE;
+    for (uint8_t i = 0; i < saved; ++i) {
+        const TraceEntry &entry = entries[(head - saved + i) & TRACE_MASK];
+        eeprom_update_block(&entry, (void *)(uintptr_t)(TRACE_ADDR + 1 + i * sizeof(TraceEntry)), sizeof(TraceEntry));
+    }
+    eeprom_update_byte((uint8_t *)(uintptr_t)TRACE_ADDR, saved);
+}
+
+ISR(WDT_vect) {
+    // loop() missed a whole timeout. The hardware has cleared WDIE, so the
+    // next timeout resets the board.
+    saveTrace();
+}
+
+void watchdogBegin() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        wdt_reset();
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = _BV(WDIE) | _BV(WDE) | _BV(WDP2) | _BV(WDP1) | _BV(WDP0); // 2 s
+    }
+}
+
+void watchdogKick() {
+    wdt_reset();
+    WDTCSR |= _BV(WDIE); // Save again next time if loop() recovered
+}
+
+#else
+
+// The virtual device has no watchdog
+void watchdogBegin() {
+}
+
+void watchdogKick() {
+}
+
+#endif
@@ -0,0 +1,528 @@
+#include "StepEngine.h"
+
+#include "Timer1.h"
+
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+const uint8_t STEP_ENGINE_CHANNELS = 2;   // Timer1 compare A and B
+const uint16_t MAX_COMPARE_TICKS = 0x8000; // Longer intervals are waited in parts
+const uint16_t START_DELAY_TICKS = 32;    // From start() to the first step, 16 us
+const uint32_t MAX_INTERVAL = 0xFFFFFF;   // Ticks, 8 s per step
+
+static StepEngine *engines[STEP_ENGINE_CHANNELS];
+
+#ifdef __AVR__
+
+uint16_t StepEngine::ticks() {
+    return TCNT1;
+}
+
+static volatile uint16_t &compareRegister(uint8_t channel) {
+    return channel == 0 ? OCR1A : OCR1B;
+}
+
+static uint8_t compareBit(uint8_t channel) {
+    return channel == 0 ? OCIE1A : OCIE1B;
+}
+
+// With interrupts off
+static void armCompare(uint8_t channel) {
+    compareRegister(channel) = TCNT1 + START_DELAY_TICKS;
+    TIFR1 = _BV(channel == 0 ? OCF1A : OCF1B);
+    TIMSK1 |= _BV(compareBit(channel));
+}
+
+static void advanceCompare(uint8_t channel, uint16_t ticks) {
+    volatile uint16_t &compare = compareRegister(channel);
+    compare += ticks;
+    // A long interrupt ahead of this one can make a short interval pass
+    // before it is set. Step late rather than a whole timer period late.
+    uint16_t ahead = compare - TCNT1;
+    if (ahead > ticks || ahead < START_DELAY_TICKS) {
+        compare = TCNT1 + START_DELAY_TICKS;
+    }
+}
+
+static void disarmCompare(uint8_t channel) {
+    TIMSK1 &= ~_BV(compareBit(channel));
+}
+
+ISR(TIMER1_COMPA_vect) {
+    engines[0]->onCompare();
+}
+
+ISR(TIMER1_COMPB_vect) {
+    engines[1]->onCompare();
+}
+
+#else
+
+// The virtual device keeps 32-bit compare times and runs due compares
+// from its ticker
+static uint32_t compareAt[STEP_ENGINE_CHANNELS];
+static bool isArmed[STEP_ENGINE_CHANNELS];
+
+static uint32_t ticksNow() {
+    return micros() * (StepEngine::TICKS_PER_SECOND / 1000000);
+}
+
+uint16_t StepEngine::ticks() {
+    return ticksNow();
+}
+
+static void armCompare(uint8_t channel) {
+    compareAt[channel] = ticksNow() + START_DELAY_TICKS;
+    isArmed[channel] = true;
+}
+
+static void advanceCompare(uint8_t channel, uint16_t ticks) {
+    compareAt[channel] += ticks;
+}
+
+static void disarmCompare(uint8_t channel) {
+    isArmed[channel] = false;
+}
+
+// Called by the virtual device from micros()
+void stepEngineTick() {
+    uint32_t now = ticksNow();
+    for (uint8_t channel = 0; channel < STEP_ENGINE_CHANNELS; ++channel) {
+        while (isArmed[channel] && (int32_t)(now - compareAt[channel]) >= 0) {
+            engines[channel]->onCompare();
+        }
+    }
+}
+
+#endif
+
+StepEngine::StepEngine(uint8_t stepPin, uint8_t dirPin, uint8_t channel)
+    : stepPin(stepPin), dirPin(dirPin), channel(channel), stepPort(NULL), stepMode(NULL), stepMask(0), stepHook(NULL),
+      mode(STOPPED), direction(1), position(0), target(0), current(0), minimum(0), cruise(0), goal(0),
+      rampStep(0), braking(0), remaining(0), preloaded(0), isDisabled(false), first(0) {
+    for (uint8_t i = 0; i < MAX_BANDS; ++i) {
+        bandLow[i] = 0;
+        bandHigh[i] = 0;
+        bandFast[i] = 0;
+        bandSlow[i] = 0;
+    }
+}
+
+void StepEngine::begin() {
+    pinMode(stepPin, OUTPUT);
+    pinMode(dirPin, OUTPUT);
+#ifdef __AVR__
+    stepPort = portOutputRegister(digitalPinToPort(stepPin));
+    stepMode = portModeRegister(digitalPinToPort(stepPin));
+    stepMask = digitalPinToBitMask(stepPin);
+#endif
+    engines[channel] = this;
+    beginTimer1();
+}
+
+uint32_t StepEngine::intervalFor(float stepsPerSecond) {
+    if (stepsPerSecond <= 0) {
+        return MAX_INTERVAL;
+    }
+    float ticks = TICKS_PER_SECOND / stepsPerSecond;
+    return ticks < MAX_INTERVAL ? (uint32_t)ticks : MAX_INTERVAL;
+}
+
+void StepEngine::setMaxSpeed(float stepsPerSecond) {
+    uint32_t interval = intervalFor(stepsPerSecond) << 8;
+    noInterrupts();
+    minimum = interval;
+    updateCruise();
+    interrupts();
+}
+
+void StepEngine::setAcceleration(float stepsPerSecond2) {
+    // Austin's first interval with the 0.676 correction, so the ramp that
+    // follows from the recurrence has the requested acceleration
+    uint32_t interval = 0; // No ramp
+    if (stepsPerSecond2 > 0) {
+        float ticks = 0.676f * sqrt(2.0f / stepsPerSecond2) * TICKS_PER_SECOND;
+        interval = (ticks < MAX_INTERVAL ? (uint32_t)ticks : MAX_INTERVAL) << 8;
+    }
+    noInterrupts();
+    first = interval;
+    interrupts();
+}
+
+void StepEngine::setStepHook(void (*hook)()) {
+    stepHook = hook;
+}
+
+void StepEngine::setBand(uint8_t index, uint16_t low, uint16_t high) {
+    if (index >= MAX_BANDS) {
+        return;
+    }
+    uint32_t fast = 0;
+    uint32_t slow = 0;
+    if (low < high) {
+        fast = intervalFor(high) << 8;
+        slow = intervalFor(low) << 8;
+    }
+    noInterrupts();
+    bandLow[index] = low;
+    bandHigh[index] = high;
+    bandFast[index] = fast;
+    bandSlow[index] = slow;
+    updateCruise();
+    interrupts();
+}
+
+int8_t StepEngine::bandIndex(uint32_t interval) const {
+    for (uint8_t i = 0; i < MAX_BANDS; ++i) {
+        if (interval > bandFast[i] && interval < bandSlow[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Moves an interval inside a band to its nearer edge, or to the slow edge
+// when that lands in another band
+uint32_t StepEngine::outsideBands(uint32_t interval) const {
+    int8_t i = bandIndex(interval);
+    if (i >= 0 && interval - bandFast[i] < bandSlow[i] - interval) {
+        interval = bandFast[i];
+    }
+    for (i = bandIndex(interval); i >= 0; i = bandIndex(interval)) {
+        interval = bandSlow[i];
+    }
+    return interval;
+}
+
+// With interrupts off
+void StepEngine::updateCruise() {
+    cruise = minimum;
+    for (int8_t i = bandIndex(cruise); i >= 0; i = bandIndex(cruise)) {
+        cruise = bandSlow[i];
+    }
+}
+
+bool StepEngine::bandAround(uint32_t interval, uint16_t &low, uint16_t &high) const {
+    int8_t i = bandIndex((interval < MAX_INTERVAL ? interval : MAX_INTERVAL) << 8);
+    if (i < 0) {
+        return false;
+    }
+    low = bandLow[i];
+    high = bandHigh[i];
+    return true;
+}
+
+uint16_t StepEngine::cruiseSpeed(uint16_t speed) const {
+    uint32_t interval = intervalFor(speed) << 8;
+    for (int8_t i = bandIndex(interval); i >= 0; i = bandIndex(interval)) {
+        speed = bandLow[i];
+        interval = bandSlow[i];
+    }
+    return speed;
+}
+
+void StepEngine::move(long steps) {
+    if (steps == 0) {
+        return;
+    }
+    noInterrupts();
+    if (!isDisabled) {
+        target = position + steps;
+        if (mode == STOPPED) {
+            start(steps > 0);
+        } else {
+            mode = MOVING; // Carries on from the current speed
+        }
+    }
+    interrupts();
+}
+
+void StepEngine::preload(long steps) {
+    noInterrupts();
+    preloaded = steps;
+    interrupts();
+}
+
+// With interrupts off
+bool StepEngine::startPreloaded() {
+    if (isDisabled || mode != STOPPED || preloaded == 0) {
+        return false;
+    }
+    target = position + preloaded;
+    start(preloaded > 0);
+    preloaded = 0;
+    return true;
+}
+
+bool StepEngine::isPreloaded() const {
+    noInterrupts();
+    bool value = preloaded != 0;
+    interrupts();
+    return value;
+}
+
+void StepEngine::runContinuous(bool isForward, uint32_t interval) {
+    uint32_t scaled = outsideBands((interval < MAX_INTERVAL ? interval : MAX_INTERVAL) << 8);
+    noInterrupts();
+    goal = scaled;
+    if (mode != STOPPED) {
+        if ((direction > 0) == isForward) {
+            mode = CONTINUOUS; // Only the goal changed, the interrupt ramps to it
+        }
+    } else if (!isDisabled) {
+        mode = CONTINUOUS;
+        start(isForward);
+    }
+    interrupts();
+}
+
+void StepEngine::stop() {
+    noInterrupts();
+    if (mode != STOPPED) {
+        mode = STOPPING;
+    }
+    interrupts();
+}
+
+void StepEngine::hardStop() {
+    // Also called from other interrupts, so restore rather than enable
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mode = STOPPED;
+        remaining = 0;
+        disarmCompare(channel);
+    }
+#else
+    mode = STOPPED;
+    remaining = 0;
+    disarmCompare(channel);
+#endif
+}
+
+void StepEngine::disableOutput() {
+    isDisabled = true; // Before the stop, so nothing restarts in between
+    hardStop();
+#ifdef __AVR__
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *stepPort &= ~stepMask;
+        *stepMode &= ~stepMask; // Input without pull-up: the driver sees low
+    }
+#else
+    digitalWrite(stepPin, LOW);
+    pinMode(stepPin, INPUT);
+#endif
+}
+
+void StepEngine::enableOutput() {
+    pinMode(stepPin, OUTPUT);
+    isDisabled = false;
+}
+
+long StepEngine::currentPosition() const {
+    noInterrupts();
+    long value = position;
+    interrupts();
+    return value;
+}
+
+void StepEngine::setCurrentPosition(long newPosition) {
+    hardStop();
+    noInterrupts();
+    position = newPosition;
+    target = newPosition;
+    interrupts();
+}
+
+long StepEngine::distanceToGo() const {
+    noInterrupts();
+    long value = mode == MOVING ? target - position : 0;
+    interrupts();
+    return value;
+}
+
+bool StepEngine::isRunning() const {
+    return mode != STOPPED;
+}
+
+uint32_t StepEngine::interval() const {
+    noInterrupts();
+    uint32_t value = mode == STOPPED ? 0 : current >> 8;
+    interrupts();
+    return value;
+}
+
+// With interrupts off
+void StepEngine::start(bool isForward) {
+    if (mode != CONTINUOUS) {
+        mode = MOVING;
+    }
+    setDirection(isForward);
+    rampStep = 0;
+    braking = 0;
+    current = first;
+    remaining = 0;
+    armCompare(channel);
+}
+
+void StepEngine::setDirection(bool isForward) {
+    direction = isForward ? 1 : -1;
+    digitalWrite(dirPin, isForward ? HIGH : LOW);
+}
+
+void StepEngine::pulseHigh() {
+#ifdef __AVR__
+    *stepPort |= stepMask;
+#else
+    digitalWrite(stepPin, HIGH);
+#endif
+}
+
+void StepEngine::pulseLow() {
+#ifdef __AVR__
+    *stepPort &= ~stepMask;
+#else
+    digitalWrite(stepPin, LOW);
+#endif
+}
+
+void StepEngine::rampUp() {
+    if (rampStep == 0) {
+        current = first;
+    } else {
+        current -= 2 * current / (4 * rampStep + 1);
+    }
+    rampStep++;
+}
+
+void StepEngine::rampDown() {
+    if (rampStep > 1) {
+        rampStep--;
+        current += 2 * current / (4 * rampStep - 1);
+    } else {
+        rampStep = 0; // Start speed, any slower speed needs no ramp
+    }
+}
+
+void StepEngine::accelerate(uint32_t limit) {
+    if (first == 0) {
+        current = limit;
+        return;
+    }
+    rampUp();
+    if (bandIndex(current) >= 0) {
+        rampUp(); // Two ramp steps per step: twice the acceleration
+    }
+    braking++;
+    if (current < limit) {
+        current = limit;
+    }
+}
+
+void StepEngine::decelerate(uint32_t limit) {
+    if (first == 0) {
+        current = limit;
+        return;
+    }
+    rampDown();
+    if (bandIndex(current) >= 0) {
+        rampDown();
+    }
+    if (braking > 0) {
+        braking--;
+    }
+    if (rampStep == 0) {
+        braking = 0;
+    }
+    if (rampStep == 0 || current > limit) {
+        current = limit;
+    }
+}
+
+// Takes one step and returns the interval to the next, 0 to stop. Runs in
+// the interrupt: integer arithmetic only.
+uint32_t StepEngine::step() {
+    pulseHigh();
+    position += direction;
+    if (stepHook != NULL) {
+        stepHook();
+    }
+
+    switch (mode) {
+        case MOVING: {
+            long toGo = (target - position) * direction;
+            if (toGo < 0 || (toGo == 0 && rampStep > 1)) {
+                // A new move() put the target behind, or too close to stop
+                // on: ramp down past it, then come back from the start speed
+                if (rampStep == 0) {
+                    setDirection(direction < 0);
+                    braking = 0;
+                    current = first;
+                } else {
+                    decelerate(first);
+                }
+                break;
+            }
+            if (toGo == 0) {
+                mode = STOPPED;
+                break;
+            }
+            if ((uint32_t)toGo <= braking) {
+                decelerate(first); // Just enough steps left to stop
+            } else if (current > cruise) {
+                accelerate(cruise);
+            } else if (current < cruise) {
+                decelerate(cruise); // The maximum speed was lowered
+            }
+            break;
+        }
+        case CONTINUOUS: {
+            uint32_t limit = goal > cruise ? goal : cruise; // Never above the maximum speed
+            if (first == 0 || (rampStep == 0 && limit >= first)) {
+                current = limit; // At or below the start speed, no ramp needed
+                rampStep = 0;
+                braking = 0;
+            } else if (current > limit) {
+                accelerate(limit);
+            } else if (current < limit) {
+                decelerate(limit);
+            }
+            break;
+        }
+        case STOPPING:
+            if (rampStep == 0) {
+                mode = STOPPED;
+            } else {
+                decelerate(first);
+            }
+            break;
+        case STOPPED:
+            break;
+    }
+
+    pulseLow(); // The arithmetic above is the pulse width, several us
+    return mode == STOPPED ? 0 : current >> 8;
+}
+
+void StepEngine::scheduleNext() {
+    uint16_t ticks = remaining < MAX_COMPARE_TICKS ? remaining : MAX_COMPARE_TICKS;
+    remaining -= ticks;
+    advanceCompare(channel, ticks);
+}
+
+void StepEngine::onCompare() {
+    if (remaining > 0) {
+        scheduleNext(); // Part of a long interval
+        return;
+    }
+    if (mode == STOPPED) {
+        disarmCompare(channel);
+        return;
+    }
+    remaining = step();
+    if (remaining == 0) {
+        disarmCompare(channel);
+        return;
+    }
+    scheduleNext();
+}
@@ -0,0 +1,22 @@
+#include "Timer1.h"
+
+#ifdef __AVR__
+
+#include <util/atomic.h>
+
+void beginTimer1() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Normal mode, prescaler 8, capture on the rising edge with the
+        // noise canceler (4 clocks of delay)
+        TCCR1A = 0;
+        TCCR1B = _BV(ICNC1) | _BV(ICES1) | _BV(CS11);
+    }
+}
+
+#else
+
+// The virtual device derives the ticks from micros()
+void beginTimer1() {
+}
+
+#endif
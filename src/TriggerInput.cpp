@@ -0,0 +1,44 @@
+#include "TriggerInput.h"
+
+static void (*triggerHandler)() = NULL;
+
+#ifdef __AVR__
+
+void beginTriggerInput(void (*handler)()) {
+    triggerHandler = handler;
+    pinMode(TRIGGER_PIN, INPUT_PULLUP);
+    PCMSK2 |= _BV(PCINT20);
+    PCIFR = _BV(PCIF2);
+    PCICR |= _BV(PCIE2);
+}
+
+ISR(PCINT2_vect) {
+    // Both edges interrupt, the level tells them apart
+    if (!(PIND & _BV(PIND4)) && triggerHandler != NULL) {
+        triggerHandler();
+    }
+}
+
+bool isTriggerActive() {
+    return !(PIND & _BV(PIND4));
+}
+
+#else
+
+// The virtual device calls this when it changes the level on the pin
+void triggerInputChange() {
+    if (isTriggerActive() && triggerHandler != NULL) {
+        triggerHandler();
+    }
+}
+
+void beginTriggerInput(void (*handler)()) {
+    triggerHandler = handler;
+    pinMode(TRIGGER_PIN, INPUT_PULLUP);
+}
+
+bool isTriggerActive() {
+    return digitalRead(TRIGGER_PIN) == LOW;
+}
+
+#endif
@@ -1,31 +1,128 @@
 #include <Wire.h>
-#include <LiquidCrystal_I2C.h>
-#include <AccelStepper.h>
 #include <EEPROM.h>
 
+#include "DryRunSensor.h"
+#include "EepromLayout.h"
+#include "EepromQueue.h"
+#include "FastLCD.h"
+#include "Faults.h"
+#include "FlowController.h"
+#include "FlowSensor.h"
+#include "FluidProfiles.h"
+#include "HostLink.h"
+#include "LoadCell.h"
+#include "Log.h"
+#include "MotionSupervisor.h"
+#include "OcclusionMonitor.h"
+#include "Parameters.h"
+#include "Recipe.h"
+#include "StateTrace.h"
+#include "StepEngine.h"
+#include "TriggerInput.h"
+
 
 const int POTENTIOMETER_PIN = A1;
-const int CALIBRATION_ADDR = 0; // EEPROM address
 const int MOTOR_STEP_PIN = 5;
 const int MOTOR_DIR_PIN = 6;
 const int STEPS_PER_REVOLUTION = 400; // Update this value if using microstepping
 
-// Initialize the stepper library
-AccelStepper stepper(AccelStepper::DRIVER, MOTOR_STEP_PIN, MOTOR_DIR_PIN);
+// Steps from the Timer1 compare A interrupt
+const uint8_t PUMP_CHANNEL = 0;
+StepEngine stepper(MOTOR_STEP_PIN, MOTOR_DIR_PIN, PUMP_CHANNEL);
+
+// Second step output, on compare B so it runs alongside the pump. The
+// axis2_mode parameter says what is wired to it: the tray indexer that TRAY
+// moves, or pump B of RECIPE. Each command refuses to run in the other mode.
+const uint8_t AXIS2_CHANNEL = 1;
+const uint8_t AXIS2_INDEXER = 0;
+const uint8_t AXIS2_PUMP = 1;
+const int INDEXER_STEP_PIN = 9;
+const int INDEXER_DIR_PIN = 10;
+StepEngine indexer(INDEXER_STEP_PIN, INDEXER_DIR_PIN, AXIS2_CHANNEL);
 
 // Initialize the LCD
-LiquidCrystal_I2C lcd(0x27, 16, 2); // Adjust the address and size
+FastLCD lcd(0x27, 16, 2); // Adjust the address and size
+
+// Host commands on the serial port
+bool handleSerialCommand(char *line);
+HostLink hostLink(Serial, handleSerialCommand);
 
 
 
 
-const unsigned long DEBOUNCE_TIME = 50;    // 50 ms debounce period
-const unsigned long LONG_PRESS_TIME = 5000; // 5 seconds for long press
-const unsigned long FAST_PRESS_TIME = 1500; // 1.5 seconds for fast press
+// Debounce and press times are parameters, see Parameters.h
 const int BUTTON_PIN = 2;
 unsigned long buttonPressStartTime = 0;
 bool isButtonPressed = false;
 
+// E-stop button and door interlock in series, normally closed to ground.
+// Pressed, open or with a broken wire, the pull-up reads high.
+const int ESTOP_PIN = 3; // INT1
+
+volatile bool isProfileMenuConfirmed = false; // Set by a fast press in ProfileMenu
+volatile bool isJogRequested = false;         // Set by a fast press in Idle
+
+bool isDispensing = false;
+bool isSuckingBack = false;
+bool isSuckedBack = false; // The last dispense ended with a suck-back
+long dispenseSteps = 0;    // Forward steps of the current dispense
+uint32_t dispenseStartPulses = 0; // Flow meter count when it started
+unsigned long lastFlowControlTime = 0;
+const unsigned long BAND_DITHER_PERIOD_MS = 1000; // Flow rates inside a resonance band
+
+// Jogging: the potentiometer sets the speed live, up to the fluid's maximum
+const unsigned long JOG_READ_INTERVAL_MS = 50;
+const int JOG_DEADBAND = 20; // Potentiometer counts at the bottom that stop the motor
+bool isJogging = false;
+unsigned long lastJogReadTime = 0;
+
+// Filling a tray: after each dispense the indexer moves the tray on by
+// tray_steps while the pump sucks back, and the next dispense starts as
+// soon as both have stopped
+bool isTrayFilling = false;
+uint8_t trayCount = 0; // Containers in the tray
+uint8_t trayFilled = 0;
+float trayVolume = 0;
+bool isIndexing = false; // Waiting for the next container
+
+// Recipes: pump A is the main pump and doses the active fluid. Pump B is
+// the second step output in axis2_mode 1 and doses the fluid of profile
+// slot pump_b_profile.
+StepEngine *const recipePumps[RECIPE_PUMPS] = {&stepper, &indexer};
+bool isRecipeRunning = false;
+int8_t recipePumpDose[RECIPE_PUMPS]; // Dose running on each pump, -1 when free
+float recipeStepsPerMl[RECIPE_PUMPS];
+uint16_t recipeSpeed[RECIPE_PUMPS];
+uint16_t recipeAcceleration[RECIPE_PUMPS];
+unsigned long recipeStartTime = 0;
+
+// Dispensing on the conveyor trigger: in Idle the armed dispense stays
+// preloaded in the step engine, and the trigger interrupt starts it
+volatile bool isTriggerArmed = false;
+float triggerVolume = 0;
+volatile bool isTriggered = false;     // Started, loop() has not caught up yet
+volatile bool isTriggerTiming = false; // Waiting for the first step
+volatile uint16_t triggerTick = 0;
+volatile uint16_t triggerLatencyUs = 0;
+volatile uint16_t maxTriggerLatencyUs = 0;
+
+// Filling by weight: tare the scale, pump at full speed for the bulk, then
+// at fill_slow_speed from fill_fine_pct of the target until it is reached
+enum FillPhase {
+    FillTare,
+    FillBulk,
+    FillFine
+};
+bool isFilling = false;
+FillPhase fillPhase = FillTare;
+int32_t fillTargetMg = 0;
+long fillStartPosition = 0;
+long fillStepLimit = 0; // More steps than this and the scale is not seeing the fluid
+unsigned long fillStartTime = 0;
+
+unsigned long bootReadyTime = 0; // micros() when setup() returned
+bool isBootReported = false;
+
 // Function prototypes
 void handleIdleState();
 void handleCalibrationMenuState();
@@ -33,7 +130,10 @@ void handleCalibratingState();
 void handlePurgingState();
 void handleRunningState();
 void handleCanceledState();
+void handleProfileMenuState();
+void handleFaultState();
 void centerTextOnLCD(const String &text, int row);
+void printPaddedOnLCD(const char *text, int width);
 
 enum SystemState {
     Idle,
@@ -41,23 +141,44 @@ enum SystemState {
     Calibrating,
     Purging,
     Running,
-    Canceled
+    Canceled,
+    ProfileMenu,
+    Fault
 };
 SystemState currentState = Idle; // Always idle on startup
 SystemState previousState = Idle;
 
-void runCalibrationMotor(int totalRevolutions) {
+const char *const STATE_NAMES[] = {"Idle", "CalibrationMenu", "Calibrating", "Purging", "Running", "Canceled", "ProfileMenu", "Fault"};
+
+// All transitions go through here so they end up in the trace
+void setState(SystemState state, TraceCause cause) {
+    if (state != currentState) {
+        traceState(currentState, state, cause);
+        currentState = state;
+    }
+}
+
+bool runCalibrationMotor(int totalRevolutions) {
     long totalSteps = totalRevolutions * STEPS_PER_REVOLUTION;
 
-    stepper.setMaxSpeed(400); // 400 steps per second (1 revolution per second)
-    stepper.setSpeed(400);
+    stepper.setMaxSpeed(paramGet(P_CAL_SPEED)); // 400 steps per second (1 revolution per second) by default
     stepper.move(totalSteps);
+    superviseMove(PUMP_CHANNEL, totalSteps, paramGet(P_CAL_SPEED), activeProfile.acceleration);
 
     centerTextOnLCD("CALIBRATION", 0);
 
     while (stepper.distanceToGo() != 0) {
-        stepper.runSpeed(); // Run the motor
+        // The step interrupt runs the motor
+        lcd.update();
+        watchdogKick();
+
+        uint8_t fault = checkMotion(PUMP_CHANNEL, stepper.currentPosition(), stepper.distanceToGo());
+        if (fault != FAULT_NONE) {
+            latchFault(fault); // loop() stops the motor
+            return false;
+        }
     }
+    return activeFault == FAULT_NONE; // Or stopped by an interrupt
 }
 
 void displayCalibrationProgress(int progressPercent) {
@@ -85,9 +206,11 @@ int queryForMeasuredLiquid() {
         lcd.setCursor(0, 1);
         lcd.print(measuredLiquid);
         lcd.print(" ml   ");
+        lcd.update();
+        watchdogKick(); // Waiting for the user is not a hang
 
         if (digitalRead(BUTTON_PIN) == LOW) {
-            delay(50); // Debounce delay
+            delay(paramGet(P_DEBOUNCE_MS)); // Debounce delay
             break; // Exit when button is pressed
         }
     }
@@ -95,8 +218,344 @@ int queryForMeasuredLiquid() {
 }
 
 void storeCalibrationValue(int measuredLiquid, int totalRevolutions) {
+    // Calibrates the active fluid profile only
     float revolutionsPerML = (float)totalRevolutions / measuredLiquid;
-    EEPROM.update(CALIBRATION_ADDR, revolutionsPerML);
+    setCalibrationPoint(activeProfile, paramGet(P_CAL_SPEED), revolutionsPerML * STEPS_PER_REVOLUTION);
+    saveActiveProfile(); // Written in the background
+    LOG(CALIBRATED, totalRevolutions, measuredLiquid);
+}
+
+void applyActiveProfile() {
+    stepper.setMaxSpeed(activeProfile.maxSpeed);
+    stepper.setAcceleration(activeProfile.acceleration);
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        stepper.setBand(i, activeBands[i].low, activeBands[i].high);
+    }
+}
+
+// The fluid's maximum speed, or the bottom of a resonance band it is in
+uint16_t dispenseSpeed() {
+    return stepper.cruiseSpeed(activeProfile.maxSpeed);
+}
+
+float dispenseStepsPerMl() {
+    return stepsPerMl(activeProfile, dispenseSpeed());
+}
+
+bool isEStopActive() {
+    return digitalRead(ESTOP_PIN) == HIGH;
+}
+
+// Inputs that keep the motor from starting, or the trigger has just
+// started it and loop() has not caught up
+bool isPumpBlocked() {
+    return isReservoirEmpty() || isEStopActive() || stepper.isRunning();
+}
+
+// Idle, the active fluid is calibrated and nothing blocks the pump: what
+// every command that runs the pump on the active fluid needs
+bool canStartPump() {
+    return currentState == Idle && dispenseStepsPerMl() > 0 && !isPumpBlocked();
+}
+
+bool isAxis2Pump() {
+    return paramGet(P_AXIS2_MODE) == AXIS2_PUMP;
+}
+
+// Speeds and calibration of a recipe pump. Pump A is already set up for
+// the active fluid, pump B is set up here for its own.
+void applyPumpProfile(uint8_t pump) {
+    if (pump == 0) {
+        recipeSpeed[0] = dispenseSpeed();
+        recipeAcceleration[0] = activeProfile.acceleration;
+        recipeStepsPerMl[0] = dispenseStepsPerMl();
+        return;
+    }
+
+    FluidProfile profile;
+    ResonanceBand bands[PROFILE_BANDS];
+    uint8_t slot = paramGet(P_PUMP_B_PROFILE);
+    readProfile(slot, profile);
+    readBands(slot, bands);
+
+    StepEngine &engine = *recipePumps[pump];
+    engine.setMaxSpeed(profile.maxSpeed);
+    engine.setAcceleration(profile.acceleration);
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        engine.setBand(i, bands[i].low, bands[i].high);
+    }
+    recipeSpeed[pump] = engine.cruiseSpeed(profile.maxSpeed);
+    recipeAcceleration[pump] = profile.acceleration;
+    recipeStepsPerMl[pump] = stepsPerMl(profile, recipeSpeed[pump]);
+}
+
+void endRecipe() {
+    isRecipeRunning = false;
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        indexer.setBand(i, 0, 0); // Pump B's, until it runs again
+    }
+}
+
+bool startRecipe() {
+    uint8_t count = recipeDoseCount();
+    if (currentState != Idle || count == 0 || isPumpBlocked() || indexer.isRunning()) {
+        return false;
+    }
+    applyPumpProfile(0);
+    if (isAxis2Pump()) {
+        applyPumpProfile(1);
+    }
+
+    // Estimated durations give the doses on the longest chains priority
+    uint32_t durations[RECIPE_MAX_DOSES];
+    for (uint8_t i = 0; i < count; ++i) {
+        const RecipeDose &dose = recipeDose(i);
+        if (dose.pump == 1 && !isAxis2Pump()) {
+            endRecipe(); // D9/D10 drive the tray indexer
+            return false;
+        }
+        float rate = recipeStepsPerMl[dose.pump];
+        if (rate <= 0 || dose.volume > paramGet(P_MAX_DISPENSE_ML)) {
+            endRecipe(); // Not calibrated, or a typo
+            return false;
+        }
+        long steps = lround(dose.volume * rate);
+        durations[i] = moveSeconds(steps, recipeSpeed[dose.pump], recipeAcceleration[dose.pump]) * 1000;
+    }
+    beginRecipe(durations);
+    LOG(RECIPE_START, count, recipeCriticalPath());
+
+    for (uint8_t pump = 0; pump < RECIPE_PUMPS; ++pump) {
+        recipePumpDose[pump] = -1;
+    }
+    recipeStartTime = millis();
+    isRecipeRunning = true;
+    isDispensing = true;
+    isSuckingBack = false;
+    setState(Running, CAUSE_DISPENSE_COMMAND);
+    return true;
+}
+
+void startRecipeDose(uint8_t pump, uint8_t dose) {
+    long steps = lround(recipeDose(dose).volume * recipeStepsPerMl[pump]);
+    if (pump == 0 && isSuckedBack) {
+        steps += activeProfile.suckBackSteps; // Refill the tube end first
+        isSuckedBack = false;
+    }
+    recipePumps[pump]->move(steps);
+    // Both pumps are supervised and stop when the reservoir runs dry. Only
+    // pump A has a current-sense input for the occlusion check.
+    superviseMove(pump == 0 ? PUMP_CHANNEL : AXIS2_CHANNEL, steps, recipeSpeed[pump], recipeAcceleration[pump]);
+    if (pump == 0) {
+        beginOcclusionMonitor();
+    }
+    recipePumpDose[pump] = dose;
+    LOG(DOSE_START, dose, pump, steps);
+}
+
+void handleRecipe() {
+    for (uint8_t pump = 0; pump < RECIPE_PUMPS; ++pump) {
+        if (recipePumpDose[pump] >= 0 && !recipePumps[pump]->isRunning()) {
+            finishDose(recipePumpDose[pump]);
+            recipePumpDose[pump] = -1;
+            if (pump == 0) {
+                endOcclusionMonitor();
+            }
+        }
+        if (recipePumpDose[pump] < 0) {
+            int8_t dose = nextDose(pump);
+            if (dose >= 0) {
+                startRecipeDose(pump, dose);
+            }
+        }
+    }
+
+    lcd.setCursor(0, 1);
+    lcd.print("Dose ");
+    lcd.print(recipeDosesDone());
+    lcd.print('/');
+    lcd.print(recipeDoseCount());
+    lcd.print("   ");
+
+    if (isRecipeDone()) {
+        LOG(RECIPE_DONE, millis() - recipeStartTime);
+        endRecipe();
+        isDispensing = false;
+        setState(Idle, CAUSE_DISPENSE_DONE);
+    }
+}
+
+bool armTrigger(float volume) {
+    if (volume <= 0 || dispenseStepsPerMl() <= 0 || volume > paramGet(P_MAX_DISPENSE_ML)) {
+        return false;
+    }
+    triggerVolume = volume;
+    maxTriggerLatencyUs = 0;
+    isTriggerArmed = true; // handleIdleState() preloads the move
+    return true;
+}
+
+void disarmTrigger() {
+    isTriggerArmed = false;
+    stepper.preload(0);
+}
+
+// From latchFault(), possibly in an ISR. The flag is enough to keep the
+// trigger from starting the preloaded move, enterFault() clears the rest.
+void onFault() {
+    isTriggerArmed = false;
+}
+
+// Steps of a dispense move
+long prepareDispense(float volume) {
+    dispenseSteps = lround(volume * dispenseStepsPerMl());
+    if (isSuckedBack) {
+        return dispenseSteps + activeProfile.suckBackSteps; // Refill the tube end first
+    }
+    return dispenseSteps;
+}
+
+// Supervision of a dispense move that has just started
+void beginDispense(long steps) {
+    isSuckedBack = false;
+    superviseMove(PUMP_CHANNEL, steps, dispenseSpeed(), activeProfile.acceleration);
+    beginOcclusionMonitor();
+    dispenseStartPulses = flowPulseCount();
+    LOG(DISPENSE_START, steps);
+    isDispensing = true;
+    isSuckingBack = false;
+}
+
+// Starts the pump on a dispense, from Idle or between tray containers
+void runDispense(float volume) {
+    long steps = prepareDispense(volume);
+    stepper.move(steps);
+    beginDispense(steps);
+}
+
+bool startDispense(float volume) {
+    if (volume <= 0 || !canStartPump()) {
+        return false;
+    }
+    if (volume > paramGet(P_MAX_DISPENSE_ML)) {
+        return false; // Most likely a typo, and more than the vessel holds
+    }
+
+    runDispense(volume);
+    setState(Running, CAUSE_DISPENSE_COMMAND);
+    return true;
+}
+
+bool startTray(uint8_t count, float volume) {
+    if (count == 0 || isAxis2Pump() || !startDispense(volume)) {
+        return false;
+    }
+    isTrayFilling = true;
+    trayCount = count;
+    trayFilled = 0;
+    trayVolume = volume;
+    LOG(TRAY_START, count, lround(volume * 1000));
+    return true;
+}
+
+void startIndex() {
+    // Read each time, so PARAM changes apply to the next container
+    indexer.setMaxSpeed(paramGet(P_INDEX_MAX_SPS));
+    indexer.setAcceleration(paramGet(P_INDEX_ACCEL_S2));
+    indexer.move(paramGet(P_TRAY_STEPS));
+    superviseMove(AXIS2_CHANNEL, paramGet(P_TRAY_STEPS), paramGet(P_INDEX_MAX_SPS), paramGet(P_INDEX_ACCEL_S2));
+}
+
+// The step engine never cruises inside a resonance band. A flow rate that
+// needs a speed inside one alternates between the speeds at its edges
+// instead, for a share of every BAND_DITHER_PERIOD_MS that averages to the
+// rate. The ramps between them are symmetric and the PID trims the rest.
+void runAtFlowRate() {
+    uint32_t interval = flowControlInterval();
+    uint16_t low;
+    uint16_t high;
+    if (stepper.bandAround(interval, low, high)) {
+        uint32_t speed = StepEngine::TICKS_PER_SECOND / interval;
+        unsigned long fastShare = (speed - low) * BAND_DITHER_PERIOD_MS / (high - low);
+        bool isFast = millis() % BAND_DITHER_PERIOD_MS < fastShare;
+        interval = StepEngine::TICKS_PER_SECOND / (isFast ? high : low);
+    }
+    stepper.runContinuous(true, interval);
+}
+
+bool startFlowControl(float mlPerMin) {
+    if (!canStartPump()) {
+        return false;
+    }
+    uint32_t target = lround(mlPerMin * 1000);
+    if (!beginFlowControl(target, dispenseStepsPerMl())) {
+        return false;
+    }
+
+    runAtFlowRate();
+    beginOcclusionMonitor();
+    dispenseStartPulses = flowPulseCount();
+    lastFlowControlTime = millis();
+    LOG(FLOW_CONTROL, target);
+    isDispensing = true;
+    isSuckingBack = false;
+    isSuckedBack = false; // The flow refills the tube end
+    setState(Running, CAUSE_DISPENSE_COMMAND);
+    return true;
+}
+
+bool startFill(float grams) {
+    if (grams <= 0 || !canStartPump()) {
+        return false;
+    }
+    if (grams > paramGet(P_MAX_DISPENSE_ML)) {
+        return false; // Taking a gram as a millilitre
+    }
+
+    fillTargetMg = lround(grams * 1000);
+    fillStepLimit = grams * dispenseStepsPerMl() * (100 + paramGet(P_MOVE_MARGIN_PCT)) / 100;
+    fillStartTime = millis();
+    fillPhase = FillTare;
+    tareLoadCell(); // The pump starts once the vessel is weighed
+    isSuckedBack = false; // The weight covers refilling the tube end
+    LOG(FILL_START, fillTargetMg);
+    isDispensing = true;
+    isSuckingBack = false;
+    isFilling = true;
+    setState(Running, CAUSE_DISPENSE_COMMAND);
+    return true;
+}
+
+void startJog() {
+    if (isPumpBlocked()) {
+        return;
+    }
+    // Not monitored for occlusion: the potentiometer needs the ADC, and
+    // someone is watching
+    lastJogReadTime = millis() - JOG_READ_INTERVAL_MS; // Read it right away
+    isJogging = true;
+    isDispensing = true;
+    isSuckingBack = false;
+    setState(Running, CAUSE_FAST_PRESS);
+}
+
+void stopDispense() {
+    LOG(DISPENSE_STOP, stepper.distanceToGo());
+    endSupervision(PUMP_CHANNEL); // Only the ramp down is left
+    endSupervision(AXIS2_CHANNEL);
+    endOcclusionMonitor();
+    endFlowControl();
+    stepper.stop(); // Decelerates in the step interrupt
+    indexer.stop();
+    isTrayFilling = false;
+    isIndexing = false;
+    if (isRecipeRunning) {
+        endRecipe();
+    }
+    isDispensing = false;
+    isSuckingBack = false;
+    isFilling = false;
+    isJogging = false;
 }
 
 
@@ -108,10 +567,30 @@ void handleIdleState() {
     lcd.setCursor(startPos, 0);
     lcd.print(idleText);
 
-    // Display "Cal:" and the calibration value on the second line
+    if (isTriggered) {
+        // The trigger interrupt has started the preloaded move
+        isTriggered = false;
+        beginDispense(prepareDispense(triggerVolume));
+        setState(Running, CAUSE_TRIGGER);
+        return;
+    }
+    if (isTriggerArmed) {
+        // Again every loop, so it follows the profile and the suck-back
+        stepper.preload(prepareDispense(triggerVolume));
+    }
+
+    if (isJogRequested) {
+        isJogRequested = false;
+        startJog();
+        return;
+    }
+
+    // Display "Cal:", the calibration value and the fluid on the second line
     lcd.setCursor(0, 1);
     lcd.print("Cal:");
-    lcd.print("0"); // Replace 'calibrationValue' with your variable
+    lcd.print(stepsPerMl(activeProfile, paramGet(P_CAL_SPEED)) / STEPS_PER_REVOLUTION, 2);
+    lcd.print(' ');
+    printPaddedOnLCD(activeProfile.name, PROFILE_NAME_LENGTH - 1);
 }
 
 void handleCalibrationMenuState() {
@@ -141,12 +620,12 @@ void handleCalibrationMenuState() {
             unsigned long pressDuration = millis() - buttonPressStartTime;
             buttonPressStartTime = 0; // Reset timer for next press
 
-            if (pressDuration >= 50 && pressDuration < 2000) {
+            if (pressDuration >= (unsigned long)paramGet(P_DEBOUNCE_MS) && pressDuration < (unsigned long)paramGet(P_MENU_HOLD_MS)) {
                 // Short press detected, enter calibration mode
-                currentState = Calibrating;
-            } else if (pressDuration >= 2000) {
+                setState(Calibrating, CAUSE_MENU_PRESS);
+            } else if (pressDuration >= (unsigned long)paramGet(P_MENU_HOLD_MS)) {
                 // Long press detected, enter purge mode
-                currentState = Purging;
+                setState(Purging, CAUSE_MENU_HOLD);
             }
         }
     }
@@ -159,20 +638,31 @@ void centerTextOnLCD(const String &text, int row) {
     lcd.print(text);
 }
 
+void printPaddedOnLCD(const char *text, int width) {
+    // Overwrite what a longer previous text left behind
+    int length = lcd.print(text);
+    for (int i = length; i < width; ++i) {
+        lcd.write(' ');
+    }
+}
+
 void handleCalibratingState() {
-    const int totalRevolutions = 10; // Define the total number of revolutions for calibration
+    const int totalRevolutions = paramGet(P_CAL_REVS); // Total number of revolutions for calibration
 
-    runCalibrationMotor(totalRevolutions); // Run the motor for calibration
+    if (!runCalibrationMotor(totalRevolutions)) { // Run the motor for calibration
+        return; // Faulted, nothing to measure
+    }
     int measuredLiquid = queryForMeasuredLiquid(); // Query for measured liquid after motor run
     storeCalibrationValue(measuredLiquid, totalRevolutions); // Store the calibration value
+    applyActiveProfile(); // Restore the fluid's speed limits
 
-    currentState = Idle; // Go back to Idle state or next appropriate state
+    setState(Idle, CAUSE_CALIBRATED); // Go back to Idle state or next appropriate state
 }
 
 void handlePurgingState() {
     static bool isPurging = false;
     static unsigned long purgeEndTime = 0;
-    const unsigned long purgeDelay = 2000; // 2 seconds delay
+    const unsigned long purgeDelay = paramGet(P_PURGE_DELAY_MS); // 2 seconds by default
 
     if (!isPurging) {
         // Display "Hold purge" centered when first entering purging mode
@@ -182,7 +672,7 @@ void handlePurgingState() {
 
         // Check for button press to start purging
         if (digitalRead(BUTTON_PIN) == LOW) {
-            delay(50); // Debounce delay
+            delay(paramGet(P_DEBOUNCE_MS)); // Debounce delay
             isPurging = true; // Start purging
             centerTextOnLCD("Purging..", 0); // Update display to show "Purging.."
             purgeEndTime = 0; // Reset the purge end time
@@ -198,7 +688,7 @@ void handlePurgingState() {
             } else if (millis() - purgeEndTime > purgeDelay) {
                 // Wait for 2 seconds after button release
                 isPurging = false;
-                currentState = Idle; // Transition back to idle state
+                setState(Idle, CAUSE_PURGE_DONE); // Transition back to idle state
                 centerTextOnLCD("Idle", 0); // Update display for idle state
             }
         } else {
@@ -208,6 +698,98 @@ void handlePurgingState() {
 }
 
 
+// What the ramp from the current speed down to fill_slow_speed still pumps
+float fillBrakingMg() {
+    uint32_t interval = stepper.interval();
+    float slow = paramGet(P_FILL_SLOW_SPEED);
+    if (interval == 0 || activeProfile.acceleration <= 0) {
+        return 0;
+    }
+    float speed = (float)StepEngine::TICKS_PER_SECOND / interval;
+    if (speed <= slow) {
+        return 0;
+    }
+    float steps = (speed * speed - slow * slow) / (2 * activeProfile.acceleration);
+    return steps * 1000 / dispenseStepsPerMl(); // A gram per millilitre
+}
+
+void handleFill() {
+    int32_t mass = loadCellMg();
+    lcd.setCursor(0, 1);
+    lcd.print(mass / 1000.0, 2);
+    lcd.print(" g   ");
+
+    if (!isLoadCellResponding() && millis() - fillStartTime > LOAD_CELL_TIMEOUT_MS) {
+        latchFault(FAULT_SCALE); // Without the scale the fill never ends
+        return;
+    }
+
+    switch (fillPhase) {
+        case FillTare:
+            if (isLoadCellTared()) {
+                fillStartPosition = stepper.currentPosition();
+                stepper.runContinuous(true, StepEngine::intervalFor(activeProfile.maxSpeed));
+                beginOcclusionMonitor();
+                fillPhase = FillBulk;
+            }
+            return;
+        case FillBulk:
+            // Slow down early enough that the ramp ends at fill_fine_pct
+            if (mass + fillBrakingMg() < fillTargetMg / 100 * paramGet(P_FILL_FINE_PCT)) {
+                break;
+            }
+            stepper.runContinuous(true, StepEngine::intervalFor(paramGet(P_FILL_SLOW_SPEED)));
+            fillPhase = FillFine;
+            // Fall through
+        case FillFine:
+            // Stop early by what is still in the air
+            if (mass >= fillTargetMg - paramGet(P_FILL_OFFSET_MG)) {
+                endOcclusionMonitor();
+                stepper.stop();
+                // No suck-back, it would take weighed fluid out again
+                LOG(FILL_DONE, mass, fillTargetMg);
+                isDispensing = false;
+                isFilling = false;
+                setState(Idle, CAUSE_DISPENSE_DONE);
+                return;
+            }
+            break;
+    }
+
+    if (stepper.currentPosition() - fillStartPosition > fillStepLimit) {
+        latchFault(FAULT_SCALE); // Pumped well past the target, the fluid is going elsewhere
+    }
+}
+
+void handleJog() {
+    if (millis() - lastJogReadTime < JOG_READ_INTERVAL_MS) {
+        return;
+    }
+    lastJogReadTime = millis();
+
+    int position = analogRead(POTENTIOMETER_PIN);
+    uint32_t speed = 0;
+    if (position > JOG_DEADBAND) {
+        speed = (uint32_t)(position - JOG_DEADBAND) * activeProfile.maxSpeed / (1023 - JOG_DEADBAND);
+    }
+    // Only the target interval changes, the step interrupt ramps to it
+    if (speed == 0) {
+        stepper.stop();
+    } else {
+        stepper.runContinuous(true, StepEngine::TICKS_PER_SECOND / speed);
+    }
+
+    lcd.setCursor(0, 1);
+    float rate = dispenseStepsPerMl();
+    if (rate > 0) {
+        lcd.print(speed * 60 / rate, 2);
+        lcd.print(" ml/min   ");
+    } else {
+        lcd.print(speed);
+        lcd.print(" steps/s   ");
+    }
+}
+
 void handleRunningState() {
     // Center "Run" text on the first line
     String runText = "Run";
@@ -215,8 +797,97 @@ void handleRunningState() {
     lcd.setCursor(startPos, 0);
     lcd.print(runText);
 
-    // Additional logic for the running state
-    // This might include updating the second line of the LCD with relevant information
+    if (!isDispensing) {
+        return;
+    }
+    if (activeFault != FAULT_NONE) {
+        // An ISR latched it since loop() looked, and its hard stop leaves
+        // nothing to go: do not take that for the end of the move
+        return;
+    }
+
+    if (isFilling) {
+        handleFill();
+        return;
+    }
+
+    if (isJogging) {
+        handleJog();
+        return;
+    }
+
+    if (isRecipeRunning) {
+        handleRecipe();
+        return;
+    }
+
+    if (isIndexing) {
+        if (!indexer.isRunning()) {
+            if (isReservoirEmpty()) {
+                latchFault(FAULT_DRY_RUN); // Ran dry during the last dispense
+                return;
+            }
+            isIndexing = false;
+            runDispense(trayVolume);
+        }
+        return;
+    }
+
+    if (isFlowControlled()) {
+        // Metered rate on the second line, runs until stopped
+        lcd.setCursor(0, 1);
+        lcd.print(flowRateUlPerMin() / 1000.0, 2);
+        lcd.print(" ml/min   ");
+        return;
+    }
+
+    // Dispensed volume on the second line
+    if (!isSuckingBack) {
+        long done = dispenseSteps - stepper.distanceToGo();
+        if (done < 0) {
+            done = 0; // Still refilling after the last suck-back
+        }
+        lcd.setCursor(0, 1);
+        lcd.print(done / dispenseStepsPerMl(), 2);
+        lcd.print(" ml   ");
+        if (isTrayFilling) {
+            lcd.setCursor(10, 1);
+            lcd.print(trayFilled + 1);
+            lcd.print('/');
+            lcd.print(trayCount);
+            lcd.print("  ");
+        }
+    }
+
+    if (stepper.distanceToGo() == 0) {
+        if (!isSuckingBack && isTrayFilling && trayFilled + 1 < trayCount) {
+            startIndex(); // Moves the tray during the suck-back
+        }
+        if (!isSuckingBack && activeProfile.suckBackSteps > 0) {
+            // Pull the fluid back from the outlet so it does not drip
+            endOcclusionMonitor(); // Reversing, the load is different
+            stepper.move(-(long)activeProfile.suckBackSteps);
+            superviseMove(PUMP_CHANNEL, activeProfile.suckBackSteps, dispenseSpeed(), activeProfile.acceleration);
+            isSuckingBack = true;
+        } else {
+            isSuckedBack = isSuckingBack;
+            LOG(DISPENSE_DONE, stepper.currentPosition(), isSuckedBack);
+            // What the meter saw against what the calibration promised
+            LOG(DISPENSE_METERED, flowVolumeMl(flowPulseCount() - dispenseStartPulses) * 1000,
+                dispenseSteps / dispenseStepsPerMl() * 1000);
+            isSuckingBack = false;
+            if (isTrayFilling && ++trayFilled < trayCount) {
+                isIndexing = true;
+                return;
+            }
+            if (isTrayFilling) {
+                LOG(TRAY_DONE, trayFilled);
+                isTrayFilling = false;
+            }
+            isDispensing = false;
+            setState(Idle, CAUSE_DISPENSE_DONE);
+        }
+    }
 }
 
 
@@ -224,22 +895,146 @@ void handleCanceledState(){
 
 }
 
+void handleProfileMenuState() {
+    // The potentiometer scrolls through the slots, a fast press selects
+    uint8_t slot = (uint32_t)analogRead(POTENTIOMETER_PIN) * PROFILE_COUNT / 1024;
+    FluidProfile profile;
+    readProfile(slot, profile);
+
+    centerTextOnLCD("Select fluid", 0);
+    lcd.setCursor(0, 1);
+    lcd.print(slot + 1);
+    lcd.print(' ');
+    printPaddedOnLCD(profile.name, PROFILE_NAME_LENGTH - 1);
+
+    if (isProfileMenuConfirmed) {
+        isProfileMenuConfirmed = false;
+        selectProfile(slot);
+        applyActiveProfile();
+        setState(Idle, CAUSE_PROFILE_SELECTED);
+    }
+}
+
+void enterFault() {
+    // Stop dead instead of ramping down: the motion itself is suspect
+    stepper.hardStop();
+    indexer.hardStop();
+    if (isDispensing) {
+        LOG(DISPENSE_ABORT, stepper.currentPosition(), activeFault);
+    }
+    endSupervision(PUMP_CHANNEL);
+    endSupervision(AXIS2_CHANNEL);
+    endOcclusionMonitor();
+    endFlowControl();
+    isDispensing = false;
+    isSuckingBack = false;
+    isFilling = false;
+    isJogging = false;
+    isTrayFilling = false;
+    isIndexing = false;
+    disarmTrigger(); // Containers pass unfilled until ARM again
+    if (isRecipeRunning) {
+        endRecipe();
+    }
+    LOG(FAULT, activeFault);
+    setState(Fault, CAUSE_FAULT);
+}
+
+void reservoirEmptyISR() {
+    // Stop within microseconds of the reservoir running dry, loop() does
+    // the rest
+    bool isPumping = stepper.isRunning() || (isAxis2Pump() && indexer.isRunning());
+    if (isPumping) {
+        stepper.hardStop();
+        if (isAxis2Pump()) {
+            indexer.hardStop(); // Pump B draws from the same reservoir
+        }
+        latchFault(FAULT_DRY_RUN);
+    }
+}
+
+void triggerISR() {
+    uint16_t now = StepEngine::ticks();
+    if (!isTriggerArmed || isTriggered || currentState != Idle || activeFault != FAULT_NONE) {
+        return;
+    }
+    if (isReservoirEmpty() || isEStopActive()) {
+        return;
+    }
+    if (stepper.startPreloaded()) {
+        triggerTick = now;
+        isTriggerTiming = true;
+        isTriggered = true;
+    }
+}
+
+// Right after each step pulse
+void pumpStep() {
+    if (isTriggerTiming) {
+        isTriggerTiming = false;
+        uint16_t latency = (uint16_t)(StepEngine::ticks() - triggerTick) / (StepEngine::TICKS_PER_SECOND / 1000000);
+        triggerLatencyUs = latency;
+        if (latency > maxTriggerLatencyUs) {
+            maxTriggerLatencyUs = latency;
+        }
+    }
+    occlusionStep();
+}
+
+void eStopISR() {
+    // Takes the step pin off the driver, whatever loop() is doing
+    stepper.disableOutput();
+    indexer.disableOutput();
+    latchFault(FAULT_ESTOP);
+}
+
+// Fast press or CLEAR in the Fault state
+bool acknowledgeFault() {
+    if (isEStopActive()) {
+        return false; // Release the E-stop or close the door first
+    }
+    clearFault();
+    stepper.enableOutput();
+    indexer.enableOutput();
+    setState(Idle, CAUSE_FAULT_CLEARED);
+    return true;
+}
+
+void handleFaultState() {
+    centerTextOnLCD("FAULT", 0);
+    lcd.setCursor(0, 1);
+    size_t length = printFault(lcd, activeFault);
+    for (size_t i = length; i < 16; ++i) {
+        lcd.write(' ');
+    }
+}
+
 void handleButtonPress() {
     if (isButtonPressed) {
         unsigned long pressDuration = millis() - buttonPressStartTime;
+        LOG(BUTTON, pressDuration);
 
-        if (pressDuration >= DEBOUNCE_TIME) {
-            if (pressDuration >= LONG_PRESS_TIME) {
+        if (pressDuration >= (unsigned long)paramGet(P_DEBOUNCE_MS)) {
+            if (pressDuration >= (unsigned long)paramGet(P_LONG_PRESS_MS)) {
                 // Long press detected
-                currentState = CalibrationMenu;
-            } else if (pressDuration <= FAST_PRESS_TIME) {
+                if (currentState != Fault) {
+                    setState(CalibrationMenu, CAUSE_LONG_PRESS);
+                }
+            } else if (pressDuration <= (unsigned long)paramGet(P_FAST_PRESS_MS)) {
                 // Fast press detected
                 if (currentState == Idle) {
-                    currentState = Running; // Toggle to operational state
+                    isJogRequested = true; // Run at the potentiometer's speed
                 } else if (currentState == Running) {
-                    currentState = Idle; // Toggle to idle state
+                    setState(Idle, CAUSE_FAST_PRESS); // Toggle to idle state
+                } else if (currentState == ProfileMenu) {
+                    isProfileMenuConfirmed = true; // Select the shown fluid
+                } else if (currentState == Fault) {
+                    acknowledgeFault();
                 }
                 // Add logic here if fast press should confirm user inputs in other states
+            } else if (currentState == Idle) {
+                // Medium press detected, choose a fluid profile
+                setState(ProfileMenu, CAUSE_MEDIUM_PRESS);
             }
         }
         isButtonPressed = false; // Reset the button press state
@@ -262,25 +1057,530 @@ void buttonPressISR() {
 }
 
 
+void loadProfilesFromEeprom() {
+    // Slots that were never written start from the pre-profile calibration
+    float revolutionsPerML;
+    eepromQueue.get(CALIBRATION_ADDR, revolutionsPerML);
+    if (isnan(revolutionsPerML)) {
+        revolutionsPerML = 0; // Erased EEPROM, never calibrated
+    }
+    loadProfiles(revolutionsPerML * STEPS_PER_REVOLUTION);
+}
+
+void printProfile(uint8_t slot) {
+    FluidProfile profile;
+    readProfile(slot, profile);
+
+    hostLink.beginReplyLine();
+    Serial.print(slot);
+    Serial.print(' ');
+    Serial.print(profile.name);
+    Serial.print(' ');
+    Serial.print(profile.maxSpeed);
+    Serial.print(' ');
+    Serial.print(profile.acceleration);
+    Serial.print(' ');
+    Serial.print(profile.suckBackSteps);
+    for (uint8_t i = 0; i < PROFILE_CURVE_POINTS; ++i) {
+        Serial.print(' ');
+        Serial.print(profile.curveSpeed[i]);
+        Serial.print(':');
+        Serial.print(profile.curveStepsPerMl[i], 1);
+    }
+    ResonanceBand bands[PROFILE_BANDS];
+    readBands(slot, bands);
+    for (uint8_t i = 0; i < PROFILE_BANDS; ++i) {
+        if (bands[i].low < bands[i].high) {
+            Serial.print(F(" band "));
+            Serial.print(bands[i].low);
+            Serial.print('-');
+            Serial.print(bands[i].high);
+        }
+    }
+    if (slot == activeProfileSlot) {
+        Serial.print(F(" *"));
+    }
+    Serial.println();
+}
+
+// Whole number in [minimum, maximum] with nothing after it, as paramSet()
+// would accept
+bool parseInRange(const char *text, long minimum, long maximum, long &value) {
+    char *end;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0' && value >= minimum && value <= maximum;
+}
+
+// A number with nothing after it, unlike atof() which reads junk as 0
+bool parseNumber(const char *text, float &value) {
+    char *end;
+    value = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+bool setBandField(uint8_t slot, int band, char *value) {
+    char *high = strchr(value, '-');
+    if (band < 0 || band >= PROFILE_BANDS || high == NULL) {
+        return false;
+    }
+    *high++ = '\0';
+    long low, top;
+    if (!parseInRange(value, 0, 65535, low) || !parseInRange(high, 0, 65535, top)) {
+        return false;
+    }
+    ResonanceBand bands[PROFILE_BANDS];
+    readBands(slot, bands);
+    bands[band].low = low;
+    bands[band].high = top;
+    writeBands(slot, bands);
+    if (slot == activeProfileSlot) {
+        applyActiveProfile();
+    }
+    return true;
+}
+
+// PROFILE                      list all slots, * marks the active one
+// PROFILE <slot>               select a slot
+// PROFILE <slot> <field> <v>   set NAME, SPEED, ACCEL, SUCKBACK or STEPSPERML
+//                              (calibration at cal_speed) of a slot
+// PROFILE <slot> BAND<n> <low>-<high>
+//                              resonance band n (1 or 2) in steps/s, 0-0
+//                              clears it
+bool handleProfileCommand() {
+    char *slotArg = strtok(NULL, " ");
+    if (slotArg == NULL) {
+        for (uint8_t slot = 0; slot < PROFILE_COUNT; ++slot) {
+            printProfile(slot);
+        }
+        return true;
+    }
+
+    long slot;
+    if (!parseInRange(slotArg, 0, PROFILE_COUNT - 1, slot)) {
+        return false;
+    }
+
+    char *field = strtok(NULL, " ");
+    char *value = strtok(NULL, " ");
+    if (field == NULL) {
+        selectProfile(slot);
+        applyActiveProfile();
+        return true;
+    }
+    if (value == NULL) {
+        return false;
+    }
+
+    if (strncmp(field, "BAND", 4) == 0) {
+        long band;
+        return parseInRange(field + 4, 1, PROFILE_BANDS, band) && setBandField(slot, band - 1, value);
+    }
+
+    FluidProfile profile;
+    readProfile(slot, profile);
+    long number;
+    float stepsPerMl;
+    if (strcmp(field, "NAME") == 0) {
+        strncpy(profile.name, value, PROFILE_NAME_LENGTH - 1);
+        profile.name[PROFILE_NAME_LENGTH - 1] = '\0';
+    } else if (strcmp(field, "SPEED") == 0) {
+        if (!parseInRange(value, PROFILE_MIN_SPEED, PROFILE_MAX_SPEED, number)) {
+            return false;
+        }
+        profile.maxSpeed = number;
+    } else if (strcmp(field, "ACCEL") == 0) {
+        if (!parseInRange(value, PROFILE_MIN_ACCELERATION, PROFILE_MAX_ACCELERATION, number)) {
+            return false;
+        }
+        profile.acceleration = number;
+    } else if (strcmp(field, "SUCKBACK") == 0) {
+        if (!parseInRange(value, 0, PROFILE_MAX_SUCK_BACK, number)) {
+            return false;
+        }
+        profile.suckBackSteps = number;
+    } else if (strcmp(field, "STEPSPERML") == 0) {
+        if (!parseNumber(value, stepsPerMl) || stepsPerMl <= 0) {
+            return false;
+        }
+        setCalibrationPoint(profile, paramGet(P_CAL_SPEED), stepsPerMl);
+    } else {
+        return false;
+    }
+    writeProfile(slot, profile);
+    if (slot == activeProfileSlot) {
+        applyActiveProfile();
+    }
+    return true;
+}
+
+// STATUS                       state, position, steps to go and the fault
+bool handleStatusCommand() {
+    hostLink.beginReplyLine();
+    Serial.print(STATE_NAMES[currentState]);
+    Serial.print(' ');
+    Serial.print(stepper.currentPosition());
+    Serial.print(' ');
+    Serial.print(stepper.distanceToGo());
+    if (activeFault != FAULT_NONE) {
+        Serial.print(' ');
+        printFault(Serial, activeFault);
+    }
+    Serial.println();
+    return true;
+}
+
+// FLOW                         meter pulses, rate in ul/min and ml metered
+//                              since the last dispense started
+bool handleFlowCommand() {
+    hostLink.beginReplyLine();
+    Serial.print(flowPulseCount());
+    Serial.print(' ');
+    Serial.print(flowRateUlPerMin());
+    Serial.print(' ');
+    Serial.println(flowVolumeMl(flowPulseCount() - dispenseStartPulses), 3);
+    return true;
+}
+
+// RATE                         target, metered and commanded rate in ul/min
+// RATE <ml/min>                pump continuously at a metered rate
+// RATE 0                       stop
+bool handleRateCommand() {
+    char *rate = strtok(NULL, " ");
+    if (rate == NULL) {
+        hostLink.beginReplyLine();
+        Serial.print(isFlowControlled() ? flowControlTarget() : 0);
+        Serial.print(' ');
+        Serial.print(flowRateUlPerMin());
+        Serial.print(' ');
+        Serial.println(isFlowControlled() ? flowControlOutput() : 0);
+        return true;
+    }
+    float mlPerMin;
+    if (!parseNumber(rate, mlPerMin)) {
+        return false;
+    }
+    if (mlPerMin == 0) {
+        if (isFlowControlled()) {
+            setState(Idle, CAUSE_DISPENSE_COMMAND); // loop() stops the pump
+        }
+        return true;
+    }
+    return startFlowControl(mlPerMin);
+}
+
+// FILL <g>                     dispense by weight on the load cell
+bool handleFillCommand() {
+    char *grams = strtok(NULL, " ");
+    return grams != NULL && startFill(atof(grams));
+}
+
+// WEIGHT                       load cell reading in mg above the tare, and raw
+// WEIGHT TARE                  zero the scale
+bool handleWeightCommand() {
+    char *action = strtok(NULL, " ");
+    if (action == NULL) {
+        if (!isLoadCellResponding()) {
+            return false;
+        }
+        hostLink.beginReplyLine();
+        Serial.print(loadCellMg());
+        Serial.print(' ');
+        Serial.println(loadCellRaw());
+        return true;
+    }
+    if (strcmp(action, "TARE") != 0 || isFilling) {
+        return false;
+    }
+    tareLoadCell();
+    return true;
+}
+
+// CLEAR                        acknowledge a fault and return to Idle,
+//                              fails while the E-stop is active
+bool handleClearCommand() {
+    if (currentState == Fault) {
+        return acknowledgeFault();
+    }
+    return true;
+}
+
+// DISPENSE <ml>                dispense with the active fluid profile
+bool handleDispenseCommand() {
+    char *volume = strtok(NULL, " ");
+    return volume != NULL && startDispense(atof(volume));
+}
+
+// TRAY                         containers filled and in the current or last tray
+// TRAY <count> <ml>            fill a tray of containers, indexing between
+//                              (axis2_mode 0)
+bool handleTrayCommand() {
+    char *count = strtok(NULL, " ");
+    char *volume = strtok(NULL, " ");
+    if (count == NULL) {
+        hostLink.beginReplyLine();
+        Serial.print(trayFilled);
+        Serial.print(' ');
+        Serial.println(trayCount);
+        return true;
+    }
+    int containers = atoi(count);
+    if (volume == NULL || containers < 1 || containers > 255) {
+        return false;
+    }
+    return startTray(containers, atof(volume));
+}
+
+// Adds the doses from token on, "A10 B5 > A2", to an empty recipe
+bool parseRecipe(char *token) {
+    clearRecipe();
+    uint8_t previous = 0; // Bit per dose of the group before
+    uint8_t group = 0;
+    for (; token != NULL; token = strtok(NULL, " ")) {
+        if (strcmp(token, ">") == 0) {
+            if (group == 0) {
+                return false;
+            }
+            previous = group;
+            group = 0;
+            continue;
+        }
+        float volume;
+        if (!parseNumber(token + 1, volume) || volume <= 0 || !addDose(token[0] - 'A', volume, previous)) {
+            return false;
+        }
+        group |= 1 << (recipeDoseCount() - 1);
+    }
+    return true;
+}
+
+// RECIPE                       doses done and in the recipe
+// RECIPE <doses> [> <doses>]...
+//                              run doses like A10, 10 ml on pump A, on pumps
+//                              A and B (axis2_mode 1). The doses of a group
+//                              run together where they can, each group after
+//                              the last.
+bool handleRecipeCommand() {
+    char *token = strtok(NULL, " ");
+    if (token == NULL) {
+        hostLink.beginReplyLine();
+        Serial.print(recipeDosesDone());
+        Serial.print(' ');
+        Serial.println(recipeDoseCount());
+        return true;
+    }
+    if (currentState != Idle) {
+        return false; // The recipe running is still needed
+    }
+
+    if (parseRecipe(token) && startRecipe()) {
+        return true;
+    }
+    clearRecipe(); // Nothing rejected is left to report
+    return false;
+}
+
+// ARM                          armed volume, last and longest latency from
+//                              the trigger to the first step in us
+// ARM <ml>                     dispense on every container the trigger sees
+// ARM 0                        disarm
+bool handleArmCommand() {
+    char *volume = strtok(NULL, " ");
+    if (volume == NULL) {
+        hostLink.beginReplyLine();
+        Serial.print(isTriggerArmed ? triggerVolume : 0, 2);
+        Serial.print(' ');
+        Serial.print(triggerLatencyUs);
+        Serial.print(' ');
+        Serial.println(maxTriggerLatencyUs);
+        return true;
+    }
+    float ml;
+    if (!parseNumber(volume, ml)) {
+        return false;
+    }
+    if (ml == 0) {
+        disarmTrigger();
+        return true;
+    }
+    return armTrigger(ml);
+}
+
+// PARAM                        list name, type, value, min, max, default, ID
+// PARAM <name|0xID>            show one parameter
+// PARAM <name|0xID> <value>    set and persist a parameter
+bool handleParamCommand() {
+    char *key = strtok(NULL, " ");
+    char *value = strtok(NULL, " ");
+    if (key == NULL) {
+        for (uint8_t index = 0; index < PARAM_COUNT; ++index) {
+            hostLink.beginReplyLine();
+            printParam(Serial, index);
+        }
+        return true;
+    }
+
+    char *end;
+    uint8_t index = PARAM_NOT_FOUND;
+    if (strncmp(key, "0x", 2) == 0) {
+        unsigned long id = strtoul(key + 2, &end, 16);
+        if (end != key + 2 && *end == '\0' && id <= 0xFFFF) {
+            index = paramFind((uint16_t)id);
+        }
+    } else {
+        index = paramFind(key);
+    }
+    if (index == PARAM_NOT_FOUND) {
+        return false;
+    }
+    if (value != NULL) {
+        long number = strtol(value, &end, 10);
+        return end != value && *end == '\0' && paramSet(index, number); // paramSet() checks the range
+    }
+    hostLink.beginReplyLine();
+    printParam(Serial, index);
+    return true;
+}
+
+void printTraceEntry(const TraceEntry &entry) {
+    hostLink.beginReplyLine();
+    Serial.print(entry.time);
+    Serial.print(' ');
+    Serial.print(STATE_NAMES[entry.from]);
+    Serial.print(' ');
+    Serial.print(STATE_NAMES[entry.to]);
+    Serial.print(' ');
+    printTraceCause(Serial, entry.cause);
+    Serial.println();
+}
+
+// TRACE                        state transitions, oldest first: time in ms,
+//                              from, to, cause
+// TRACE SAVED                  the transitions saved by the last watchdog reset
+bool handleTraceCommand() {
+    char *which = strtok(NULL, " ");
+    TraceEntry entry;
+    if (which == NULL) {
+        uint8_t count = traceCount();
+        for (uint8_t i = 0; i < count; ++i) {
+            readTrace(i, entry);
+            printTraceEntry(entry);
+        }
+        return true;
+    }
+    if (strcmp(which, "SAVED") != 0) {
+        return false;
+    }
+    uint8_t count = savedTraceCount();
+    for (uint8_t i = 0; i < count; ++i) {
+        readSavedTrace(i, entry);
+        printTraceEntry(entry);
+    }
+    return true;
+}
+
+// Called by hostLink in sequence order, which adds the tags and the final
+// OK/ERR line (see HostLink.h for the framing)
+bool handleSerialCommand(char *line) {
+    char *command = strtok(line, " ");
+
+    if (command == NULL) {
+        return false;
+    } else if (strcmp(command, "PING") == 0) {
+        return true;
+    } else if (strcmp(command, "STATUS") == 0) {
+        return handleStatusCommand();
+    } else if (strcmp(command, "DISPENSE") == 0) {
+        return handleDispenseCommand();
+    } else if (strcmp(command, "PROFILE") == 0) {
+        return handleProfileCommand();
+    } else if (strcmp(command, "PARAM") == 0) {
+        return handleParamCommand();
+    } else if (strcmp(command, "TRACE") == 0) {
+        return handleTraceCommand();
+    } else if (strcmp(command, "CLEAR") == 0) {
+        return handleClearCommand();
+    } else if (strcmp(command, "FLOW") == 0) {
+        return handleFlowCommand();
+    } else if (strcmp(command, "RATE") == 0) {
+        return handleRateCommand();
+    } else if (strcmp(command, "FILL") == 0) {
+        return handleFillCommand();
+    } else if (strcmp(command, "WEIGHT") == 0) {
+        return handleWeightCommand();
+    } else if (strcmp(command, "TRAY") == 0) {
+        return handleTrayCommand();
+    } else if (strcmp(command, "ARM") == 0) {
+        return handleArmCommand();
+    } else if (strcmp(command, "RECIPE") == 0) {
+        return handleRecipeCommand();
+    }
+    return false;
+}
+
+void reportBootTime() {
+    // The display finishes its power-up sequence a while after setup()
+    if (isBootReported || !lcd.isIdle()) {
+        return;
+    }
+    isBootReported = true;
+
+    Serial.print(F("Ready in "));
+    Serial.print(bootReadyTime);
+    Serial.print(F(" us, display in "));
+    Serial.print(micros());
+    Serial.println(F(" us"));
+}
+
 void setup() {
-    // Initialize serial communication, LCD, stepper motor, etc.
-    Serial.begin(9600);
+    // Nothing here waits on hardware. The LCD power-up and reset timing is
+    // scheduled by lcd.update() from loop(), so the pump accepts input while
+    // the display is still starting.
+    Serial.begin(115200); // Host clients pipeline commands
     pinMode(BUTTON_PIN, INPUT_PULLUP);
     attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), buttonPressISR, CHANGE);
+    loadParams();
+    loadProfilesFromEeprom();
+    stepper.begin();
+    stepper.setStepHook(pumpStep);
+    indexer.begin();
+    applyActiveProfile(); // Speed and acceleration limits of the selected fluid
+    beginFlowSensor();
+    beginLoadCell();
+    beginDryRunSensor(reservoirEmptyISR);
+    pinMode(ESTOP_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(ESTOP_PIN), eStopISR, RISING);
+    if (isEStopActive()) {
+        eStopISR(); // Powered up with the E-stop pressed or the door open
+    }
+    setFaultHook(onFault);
+    beginTriggerInput(triggerISR);
+
     lcd.init();
     lcd.backlight();
-    stepper.setMaxSpeed(6000); // Set a high max speed
-    stepper.setAcceleration(800); // Set a reasonable acceleration
 
-    // Optional: Display a welcome message or clear the display
-    lcd.clear();
+#ifdef LCD_SERIAL_MIRROR
+    // Show the display on a terminal attached to the serial port
+    lcd.setMirror(&Serial);
+#endif
+
+    traceState(Idle, Idle, CAUSE_BOOT);
+    watchdogBegin(); // Resets the board if loop() hangs, saving the trace first
+    bootReadyTime = micros();
 }
 
 void loop() {
+    if (activeFault != FAULT_NONE && currentState != Fault) {
+        enterFault(); // Latched by a check below or an ISR
+    }
 
     if (currentState != previousState) {
-        // State has changed, clear the LCD
+        // State has changed, blank the framebuffer. The new screen drawn below
+        // is diffed against the old one, so only changed characters are sent.
         lcd.clear();
+        LOG(STATE, previousState, currentState);
+        if (previousState == Running && isDispensing) {
+            stopDispense(); // Canceled with the button
+        }
         previousState = currentState; // Update the previous state
     }
 
@@ -303,7 +1603,35 @@ void loop() {
         case Canceled:
             handleCanceledState();
             break;
+        case ProfileMenu:
+            handleProfileMenuState();
+            break;
+        case Fault:
+            handleFaultState();
+            break;
     }
 
     // Handle common tasks here (if any)
+    watchdogKick();
+    loadCellUpdate(); // Only reads when a sample is ready
+    if (isFlowControlled() && millis() - lastFlowControlTime >= (unsigned long)paramGet(P_PID_UPDATE_MS)) {
+        // Fixed period, so the integral and derivative gains mean the same
+        // whatever loop() is doing
+        lastFlowControlTime += paramGet(P_PID_UPDATE_MS);
+        updateFlowControl(flowRateUlPerMin());
+    }
+    if (isFlowControlled()) {
+        runAtFlowRate();
+    }
+    uint8_t fault = checkMotion(PUMP_CHANNEL, stepper.currentPosition(), stepper.distanceToGo());
+    if (fault == FAULT_NONE) {
+        fault = checkMotion(AXIS2_CHANNEL, indexer.currentPosition(), indexer.distanceToGo());
+    }
+    if (fault != FAULT_NONE) {
+        latchFault(fault);
+    }
+    hostLink.poll();
+    logFlush(Serial); // Between replies, never inside one
+    lcd.update();
+    reportBootTime();
 }
\ No newline at end of file
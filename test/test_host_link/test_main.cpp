@@ -0,0 +1,172 @@
+#include <unity.h>
+
+#include "HostLink.h"
+
+#include <string>
+#include <vector>
+
+// Serial port stand-in: the test writes what the host sends and reads back
+// what the link printed
+class FakeStream : public Stream {
+public:
+    std::string input;
+    std::string output;
+
+    int available() override { return input.size(); }
+    int read() override {
+        if (input.empty()) {
+            return -1;
+        }
+        char c = input[0];
+        input.erase(0, 1);
+        return c;
+    }
+    int peek() override { return input.empty() ? -1 : input[0]; }
+    size_t write(uint8_t value) override {
+        output += (char)value;
+        return 1;
+    }
+    using Print::write;
+};
+
+static FakeStream stream;
+static HostLink *hostLink = NULL;
+static std::vector<std::string> executed;
+
+static bool recordCommand(char *command) {
+    executed.push_back(command);
+    if (strcmp(command, "STATUS") == 0) {
+        hostLink->beginReplyLine();
+        stream.println("Idle");
+    }
+    return strcmp(command, "BAD") != 0;
+}
+
+// Sends lines from the host and returns what the hostLink answered
+static std::string send(const char *lines) {
+    stream.input += lines;
+    stream.output.clear();
+    while (stream.available() > 0) {
+        hostLink->poll();
+    }
+    return stream.output;
+}
+
+void setUp() {
+    stream.input.clear();
+    stream.output.clear();
+    executed.clear();
+    hostLink = new HostLink(stream, recordCommand);
+}
+
+void tearDown() {
+    delete hostLink;
+    hostLink = NULL;
+}
+
+void test_frames_in_order_run_and_reply_tagged() {
+    TEST_ASSERT_EQUAL_STRING("#0 OK\r\n#1 Idle\r\n#1 OK\r\n#2 ERR\r\n", send("#0 PING\n#1 STATUS\n#2 BAD\n").c_str());
+    TEST_ASSERT_EQUAL(3, executed.size());
+    TEST_ASSERT_EQUAL_STRING("STATUS", executed[1].c_str());
+}
+
+void test_untagged_command_runs_outside_the_window() {
+    TEST_ASSERT_EQUAL_STRING("Idle\r\nOK\r\n", send("STATUS\n").c_str());
+    TEST_ASSERT_EQUAL_STRING("#0 OK\r\n", send("#0 PING\n").c_str());
+}
+
+void test_frame_ahead_is_held_until_the_gap_fills() {
+    TEST_ASSERT_EQUAL_STRING("@0\r\n", send("#2 C\n").c_str());
+    TEST_ASSERT_EQUAL_STRING("@0\r\n", send("#1 B\n").c_str());
+    TEST_ASSERT_EQUAL(0, executed.size());
+
+    TEST_ASSERT_EQUAL_STRING("#0 OK\r\n#1 OK\r\n#2 OK\r\n", send("#0 A\n").c_str());
+    TEST_ASSERT_EQUAL(3, executed.size());
+    TEST_ASSERT_EQUAL_STRING("A", executed[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("B", executed[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("C", executed[2].c_str());
+}
+
+void test_frame_beyond_a_full_window_is_dropped() {
+    // 1..3 fill the window behind the missing 0, 4 does not fit
+    send("#1 B\n#2 C\n#3 D\n");
+    TEST_ASSERT_EQUAL_STRING("@0\r\n", send("#4 E\n").c_str());
+
+    send("#0 A\n");
+    TEST_ASSERT_EQUAL(4, executed.size());
+    TEST_ASSERT_EQUAL_STRING("D", executed[3].c_str());
+
+    // The host resends it once the window has room
+    TEST_ASSERT_EQUAL_STRING("#4 OK\r\n", send("#4 E\n").c_str());
+    TEST_ASSERT_EQUAL_STRING("E", executed[4].c_str());
+}
+
+void test_duplicate_is_acked_not_replayed() {
+    send("#0 DISPENSE\n#1 PING\n");
+    TEST_ASSERT_EQUAL_STRING("@2\r\n", send("#0 DISPENSE\n").c_str());
+    TEST_ASSERT_EQUAL_STRING("@2\r\n", send("#1 PING\n").c_str());
+    TEST_ASSERT_EQUAL(2, executed.size());
+
+    // A held frame sent twice is still run once
+    send("#3 D\n#3 D\n");
+    send("#2 C\n");
+    TEST_ASSERT_EQUAL(4, executed.size());
+}
+
+void test_sequence_wraps_from_255_to_0() {
+    TEST_ASSERT_EQUAL_STRING("@254\r\n", send("SYNC 254\n").c_str());
+    TEST_ASSERT_EQUAL_STRING("#254 OK\r\n#255 OK\r\n#0 OK\r\n", send("#254 A\n#255 B\n#0 C\n").c_str());
+    TEST_ASSERT_EQUAL(3, executed.size());
+
+    // 255 is now behind, not 255 ahead
+    TEST_ASSERT_EQUAL_STRING("@1\r\n", send("#255 B\n").c_str());
+    TEST_ASSERT_EQUAL(3, executed.size());
+}
+
+void test_frames_held_across_the_wrap_run_in_order() {
+    send("SYNC 254\n");
+    TEST_ASSERT_EQUAL_STRING("@254\r\n", send("#1 D\n").c_str());
+    send("#0 C\n#255 B\n");
+    TEST_ASSERT_EQUAL_STRING("#254 OK\r\n#255 OK\r\n#0 OK\r\n#1 OK\r\n", send("#254 A\n").c_str());
+    TEST_ASSERT_EQUAL(4, executed.size());
+    TEST_ASSERT_EQUAL_STRING("A", executed[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("D", executed[3].c_str());
+}
+
+void test_largest_recipe_frame_fits_the_line() {
+    const char *recipe = "RECIPE A125.25 B125.25 > A125.25 B125.25 > A125.25 B125.25 > A125.25 B125.25";
+    std::string frame = std::string("#255 ") + recipe + "\n";
+    send("SYNC 255\n");
+    TEST_ASSERT_EQUAL_STRING("#255 OK\r\n", send(frame.c_str()).c_str());
+    TEST_ASSERT_EQUAL(1, executed.size());
+    TEST_ASSERT_EQUAL_STRING(recipe, executed[0].c_str());
+}
+
+void test_overlong_frame_is_answered_not_run() {
+    std::string tooLong(CommandLine::MAX_LENGTH + 1, 'A');
+    TEST_ASSERT_EQUAL_STRING("#0 ERR\r\n", send(("#0 " + tooLong + "\n").c_str()).c_str());
+    TEST_ASSERT_EQUAL(0, executed.size());
+
+    // It takes its turn in the window, and the line after it is whole again
+    send("#2 C\n");
+    TEST_ASSERT_EQUAL_STRING("#1 ERR\r\n#2 OK\r\n", send(("#1 " + tooLong + "\n").c_str()).c_str());
+    TEST_ASSERT_EQUAL(1, executed.size());
+    TEST_ASSERT_EQUAL_STRING("C", executed[0].c_str());
+
+    TEST_ASSERT_EQUAL_STRING("ERR\r\n", send((tooLong + "\n").c_str()).c_str());
+    TEST_ASSERT_EQUAL(1, executed.size());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_in_order_run_and_reply_tagged);
+    RUN_TEST(test_untagged_command_runs_outside_the_window);
+    RUN_TEST(test_frame_ahead_is_held_until_the_gap_fills);
+    RUN_TEST(test_frame_beyond_a_full_window_is_dropped);
+    RUN_TEST(test_duplicate_is_acked_not_replayed);
+    RUN_TEST(test_sequence_wraps_from_255_to_0);
+    RUN_TEST(test_frames_held_across_the_wrap_run_in_order);
+    RUN_TEST(test_largest_recipe_frame_fits_the_line);
+    RUN_TEST(test_overlong_frame_is_answered_not_run);
+    return UNITY_END();
+}
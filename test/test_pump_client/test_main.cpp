@@ -0,0 +1,205 @@
+#include <unity.h>
+
+#include "PumpClient.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// The tests play the device on the other end of a socketpair, so they
+// decide which frames get through: dropped, duplicated or out of order.
+static int deviceFd = -1;
+static std::string deviceReceived;
+static PumpClient *client = NULL;
+static std::vector<PumpReply> replies;
+
+static double nowMs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void deviceSend(const std::string &lines) {
+    TEST_ASSERT_EQUAL(lines.size(), write(deviceFd, lines.data(), lines.size()));
+}
+
+// Complete lines the client has written since the last call
+static std::vector<std::string> deviceReceive() {
+    char buffer[1024];
+    ssize_t n;
+    while ((n = read(deviceFd, buffer, sizeof(buffer))) > 0) {
+        deviceReceived.append(buffer, n);
+    }
+    std::vector<std::string> lines;
+    size_t end;
+    while ((end = deviceReceived.find('\n')) != std::string::npos) {
+        lines.push_back(deviceReceived.substr(0, end));
+        deviceReceived.erase(0, end + 1);
+    }
+    return lines;
+}
+
+static void submit(const std::string &command) {
+    client->submit(command, [](const PumpReply &reply) { replies.push_back(reply); });
+}
+
+// Polls until count replies are in or waitMs has passed
+static void pollFor(size_t count, int waitMs) {
+    double deadline = nowMs() + waitMs;
+    while (replies.size() < count && nowMs() < deadline) {
+        TEST_ASSERT_TRUE(client->poll(5));
+    }
+}
+
+void setUp() {
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    deviceFd = fds[1];
+    fcntl(deviceFd, F_SETFL, O_NONBLOCK);
+    deviceReceived.clear();
+    replies.clear();
+
+    // Answer the SYNC ahead of time
+    deviceSend("@0\n");
+    client = new PumpClient();
+    client->setTimeout(50);
+    TEST_ASSERT_TRUE(client->open(fds[0]));
+    std::vector<std::string> sync = deviceReceive();
+    TEST_ASSERT_EQUAL(1, sync.size());
+    TEST_ASSERT_EQUAL_STRING("SYNC 0", sync[0].c_str());
+}
+
+void tearDown() {
+    delete client; // Closes its end
+    client = NULL;
+    close(deviceFd);
+}
+
+void test_replies_out_of_order_match_by_tag() {
+    submit("STATUS");
+    submit("PING");
+    TEST_ASSERT_TRUE(client->flush());
+    std::vector<std::string> frames = deviceReceive();
+    TEST_ASSERT_EQUAL(2, frames.size());
+    TEST_ASSERT_EQUAL_STRING("#0 STATUS", frames[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("#1 PING", frames[1].c_str());
+
+    deviceSend("#1 OK\n#0 Idle 0 0\n#0 OK\n");
+    pollFor(2, 200);
+    TEST_ASSERT_EQUAL(2, replies.size());
+    TEST_ASSERT_EQUAL(1, replies[0].sequence);
+    TEST_ASSERT_EQUAL(0, replies[1].sequence);
+    TEST_ASSERT_EQUAL(1, replies[1].lines.size());
+    TEST_ASSERT_EQUAL_STRING("Idle 0 0", replies[1].lines[0].c_str());
+    TEST_ASSERT_EQUAL(0, client->retries());
+}
+
+void test_duplicated_reply_completes_once() {
+    submit("PING");
+    TEST_ASSERT_TRUE(client->flush());
+    deviceReceive();
+
+    deviceSend("#0 OK\n#0 OK\n");
+    pollFor(2, 100);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_TRUE(replies[0].isOk);
+    TEST_ASSERT_EQUAL(0, client->inFlight());
+}
+
+void test_dropped_frame_is_resent_after_timeout() {
+    submit("PING");
+    TEST_ASSERT_TRUE(client->flush());
+    TEST_ASSERT_EQUAL(1, deviceReceive().size()); // Lost on the way
+
+    pollFor(1, 80);
+    std::vector<std::string> frames = deviceReceive();
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL_STRING("#0 PING", frames[0].c_str()); // Same tag
+    TEST_ASSERT_EQUAL(1, client->retries());
+
+    deviceSend("#0 OK\n");
+    pollFor(1, 100);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_TRUE(replies[0].isOk);
+    TEST_ASSERT_FALSE(replies[0].isReplyLost);
+}
+
+void test_gap_ack_resends_the_missing_frame_at_once() {
+    client->setTimeout(1000);
+    submit("DISPENSE 5");
+    submit("STATUS");
+    TEST_ASSERT_TRUE(client->flush());
+    TEST_ASSERT_EQUAL(2, deviceReceive().size());
+
+    // #0 was lost, #1 is held by the device, which asks for #0
+    double start = nowMs();
+    deviceSend("@0\n");
+    std::vector<std::string> frames;
+    while (frames.empty() && nowMs() - start < 500) {
+        TEST_ASSERT_TRUE(client->poll(5));
+        frames = deviceReceive();
+    }
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL_STRING("#0 DISPENSE 5", frames[0].c_str());
+    TEST_ASSERT_LESS_THAN(500, nowMs() - start); // Not the 1 s timeout
+    TEST_ASSERT_EQUAL(1, client->retries());
+
+    // A second gap ack for the same frame does not resend it again
+    deviceSend("@0\n");
+    client->poll(5);
+    TEST_ASSERT_EQUAL(0, deviceReceive().size());
+
+    deviceSend("#0 OK\n#1 Running\n#1 OK\n");
+    pollFor(2, 200);
+    TEST_ASSERT_EQUAL(2, replies.size());
+    TEST_ASSERT_TRUE(replies[0].isOk);
+    TEST_ASSERT_TRUE(replies[1].isOk);
+    TEST_ASSERT_EQUAL(1, client->retries());
+}
+
+void test_lost_reply_is_reported_not_repeated() {
+    submit("DISPENSE 5");
+    TEST_ASSERT_TRUE(client->flush());
+    TEST_ASSERT_EQUAL(1, deviceReceive().size()); // Executed, reply lost
+
+    pollFor(1, 80);
+    TEST_ASSERT_EQUAL(1, deviceReceive().size()); // The resend
+
+    // The device has run #0 already, so it only acks the duplicate
+    deviceSend("@1\n");
+    pollFor(1, 100);
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_TRUE(replies[0].isReplyLost);
+    TEST_ASSERT_FALSE(replies[0].isOk);
+    TEST_ASSERT_FALSE(replies[0].isTimedOut);
+}
+
+void test_unanswered_command_times_out_after_retries() {
+    client->setTimeout(20);
+    client->setRetries(2);
+    submit("PING");
+    TEST_ASSERT_TRUE(client->drain());
+
+    TEST_ASSERT_EQUAL(1, replies.size());
+    TEST_ASSERT_TRUE(replies[0].isTimedOut);
+    TEST_ASSERT_FALSE(replies[0].isOk);
+    TEST_ASSERT_EQUAL(2, client->retries());
+    TEST_ASSERT_EQUAL(3, deviceReceive().size()); // First attempt and two resends
+
+    // A reply to the abandoned tag arriving late is ignored
+    deviceSend("#0 OK\n");
+    client->poll(5);
+    TEST_ASSERT_EQUAL(1, replies.size());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_replies_out_of_order_match_by_tag);
+    RUN_TEST(test_duplicated_reply_completes_once);
+    RUN_TEST(test_dropped_frame_is_resent_after_timeout);
+    RUN_TEST(test_gap_ack_resends_the_missing_frame_at_once);
+    RUN_TEST(test_lost_reply_is_reported_not_repeated);
+    RUN_TEST(test_unanswered_command_times_out_after_retries);
+    return UNITY_END();
+}
@@ -0,0 +1,109 @@
+#include <unity.h>
+
+#include "Recipe.h"
+
+void setUp() {
+    clearRecipe();
+}
+
+void tearDown() {
+}
+
+void test_dose_waits_for_what_it_depends_on() {
+    TEST_ASSERT_TRUE(addDose(0, 10, 0));
+    TEST_ASSERT_TRUE(addDose(1, 5, 1 << 0));
+    uint32_t durations[] = {1000, 500};
+    beginRecipe(durations);
+
+    TEST_ASSERT_EQUAL(-1, nextDose(1)); // Dose 0 still to finish
+    TEST_ASSERT_EQUAL(0, nextDose(0));
+    TEST_ASSERT_EQUAL(-1, nextDose(1));
+    finishDose(0);
+    TEST_ASSERT_EQUAL(1, nextDose(1));
+    TEST_ASSERT_FALSE(isRecipeDone());
+    finishDose(1);
+    TEST_ASSERT_TRUE(isRecipeDone());
+    TEST_ASSERT_EQUAL(2, recipeDosesDone());
+}
+
+void test_independent_doses_start_together() {
+    TEST_ASSERT_TRUE(addDose(0, 10, 0));
+    TEST_ASSERT_TRUE(addDose(1, 5, 0));
+    uint32_t durations[] = {1000, 500};
+    beginRecipe(durations);
+
+    TEST_ASSERT_EQUAL(0, nextDose(0));
+    TEST_ASSERT_EQUAL(1, nextDose(1));
+    TEST_ASSERT_EQUAL(-1, nextDose(0)); // Each is handed out once
+    TEST_ASSERT_EQUAL(1000, recipeCriticalPath());
+}
+
+void test_longest_chain_goes_first_on_a_pump() {
+    // A1 and A2 are both ready, but B3 waits for A2
+    TEST_ASSERT_TRUE(addDose(0, 1, 0));
+    TEST_ASSERT_TRUE(addDose(0, 2, 0));
+    TEST_ASSERT_TRUE(addDose(1, 3, 1 << 1));
+    uint32_t durations[] = {400, 300, 800};
+    beginRecipe(durations);
+
+    TEST_ASSERT_EQUAL(1100, recipeCriticalPath());
+    TEST_ASSERT_EQUAL(1, nextDose(0));
+    finishDose(1);
+    TEST_ASSERT_EQUAL(2, nextDose(1));
+    TEST_ASSERT_EQUAL(0, nextDose(0)); // Runs alongside B3
+}
+
+void test_groups_run_in_sequence() {
+    // A10 > B5 A3 > A2
+    TEST_ASSERT_TRUE(addDose(0, 10, 0));
+    TEST_ASSERT_TRUE(addDose(1, 5, 1 << 0));
+    TEST_ASSERT_TRUE(addDose(0, 3, 1 << 0));
+    TEST_ASSERT_TRUE(addDose(0, 2, 1 << 1 | 1 << 2));
+    uint32_t durations[] = {2000, 1500, 700, 500};
+    beginRecipe(durations);
+
+    TEST_ASSERT_EQUAL(4000, recipeCriticalPath());
+    TEST_ASSERT_EQUAL(0, nextDose(0));
+    finishDose(0);
+    TEST_ASSERT_EQUAL(1, nextDose(1));
+    TEST_ASSERT_EQUAL(2, nextDose(0));
+    finishDose(2);
+    TEST_ASSERT_EQUAL(-1, nextDose(0)); // Dose 3 also waits for B5
+    finishDose(1);
+    TEST_ASSERT_EQUAL(3, nextDose(0));
+}
+
+void test_dependency_on_itself_or_a_later_dose_is_rejected() {
+    // Only earlier doses can be waited for, so no cycle can be built
+    TEST_ASSERT_FALSE(addDose(0, 1, 1 << 0));
+    TEST_ASSERT_TRUE(addDose(0, 1, 0));
+    TEST_ASSERT_FALSE(addDose(1, 1, 1 << 1)); // Itself
+    TEST_ASSERT_FALSE(addDose(1, 1, 1 << 2)); // Not added yet
+    TEST_ASSERT_FALSE(addDose(1, 1, 1 << 7)); // Unknown
+    TEST_ASSERT_EQUAL(1, recipeDoseCount());
+}
+
+void test_unknown_pump_is_rejected() {
+    TEST_ASSERT_FALSE(addDose(RECIPE_PUMPS, 1, 0));
+    TEST_ASSERT_EQUAL(0, recipeDoseCount());
+}
+
+void test_full_recipe_is_rejected() {
+    for (uint8_t i = 0; i < RECIPE_MAX_DOSES; ++i) {
+        TEST_ASSERT_TRUE(addDose(i % RECIPE_PUMPS, 1, 0));
+    }
+    TEST_ASSERT_FALSE(addDose(0, 1, 0));
+    TEST_ASSERT_EQUAL(RECIPE_MAX_DOSES, recipeDoseCount());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_dose_waits_for_what_it_depends_on);
+    RUN_TEST(test_independent_doses_start_together);
+    RUN_TEST(test_longest_chain_goes_first_on_a_pump);
+    RUN_TEST(test_groups_run_in_sequence);
+    RUN_TEST(test_dependency_on_itself_or_a_later_dose_is_rejected);
+    RUN_TEST(test_unknown_pump_is_rejected);
+    RUN_TEST(test_full_recipe_is_rejected);
+    return UNITY_END();
+}